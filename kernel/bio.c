@@ -16,40 +16,344 @@
 
 #include "types.h"
 #include "param.h"
+#include "memlayout.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "stat.h"
+
+// Buffers come in groups of BPG that share one page of data,
+// each group's headers adjacent. The cache is sized at boot to
+// 1/BCACHEFRAC of physical memory; under memory pressure kalloc()
+// calls bshrink() to take back the page of an unused group, and
+// bget() later regrows the cache when memory is free again. The
+// cache never shrinks below NBUF buffers.
+//
+// Replacement follows 2Q, so that reading a large file once does
+// not push hot blocks out of the cache. A block enters the "in"
+// queue, in FIFO order, when it is first read. Unused buffers are
+// recycled from "in" while it holds more than a quarter of the
+// cache. A block recycled from "in" is remembered in the ghost
+// table; if it is read again while still remembered, it enters the
+// "hot" queue, which is kept in LRU order. Metadata blocks (those
+// before the data blocks, plus blocks fs.c marks as directory or
+// indirect blocks) always go to "hot", and are recycled only when
+// no other unused buffer is left.
+#define BPG (PGSIZE / BSIZE)   // buffers per group
+#define NBHASH 1021            // hash chains
+#define BMINFREE 256           // regrow only if this many pages are free
+#define NGHOST 2048            // remembered blocks recycled from "in"
+
+extern char end[]; // first address after kernel.
+
+struct ghost {
+  uint dev;
+  uint blockno;
+  struct ghost *hnext;
+};
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *hash[NBHASH];
+  int ngroup;              // groups with data pages
+  struct buf *spare;       // groups without, through next
+  uint metadev;            // blocks of metadev before metaend
+  uint metaend;            //   are metadata
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  // Two lists of buffers, through prev/next.
+  // in.next was read most recently, in.prev least.
+  // hot.next was used most recently, hot.prev least.
+  struct buf in;
+  struct buf hot;
+  int nin;
+
+  // Ring of the blocks most recently recycled from "in",
+  // hashed on (dev, blockno).
+  struct ghost ghost[NGHOST];
+  struct ghost *ghash[NBHASH];
+  int ghand;
+
+  struct bcachestat stat;
 } bcache;
 
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBHASH;
+}
+
+// Remove b from its hash chain. Caller must hold bcache.lock.
+static void
+bunhash(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bcache.hash[bhash(b->dev, b->blockno)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == b){
+      *pp = b->hnext;
+      break;
+    }
+  }
+  b->hnext = 0;
+}
+
+// Remove b from its queue. Caller must hold bcache.lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  if(b->hot == 0)
+    bcache.nin--;
+}
+
+// Insert b in the "hot" queue if hot, else the "in" queue,
+// at the most recent end if head, else the least recent end.
+// Caller must hold bcache.lock.
+static void
+blink(struct buf *b, int hot, int head)
+{
+  struct buf *q;
+
+  q = hot ? &bcache.hot : &bcache.in;
+  if(head){
+    b->next = q->next;
+    b->prev = q;
+  } else {
+    b->next = q;
+    b->prev = q->prev;
+  }
+  b->next->prev = b;
+  b->prev->next = b;
+  b->hot = hot;
+  if(hot == 0)
+    bcache.nin++;
+}
+
+// Drop the ghost entry g from its hash chain, if it is on one.
+// Caller must hold bcache.lock.
+static void
+gunhash(struct ghost *g)
+{
+  struct ghost **pp;
+
+  for(pp = &bcache.ghash[bhash(g->dev, g->blockno)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == g){
+      *pp = g->hnext;
+      break;
+    }
+  }
+  g->hnext = 0;
+  g->dev = -1;
+}
+
+// Remember that (dev, blockno) was recycled from "in",
+// forgetting the oldest such block.
+// Caller must hold bcache.lock.
+static void
+gremember(uint dev, uint blockno)
+{
+  struct ghost *g;
+  uint h;
+
+  g = &bcache.ghost[bcache.ghand];
+  bcache.ghand = (bcache.ghand + 1) % NGHOST;
+  gunhash(g);
+  g->dev = dev;
+  g->blockno = blockno;
+  h = bhash(dev, blockno);
+  g->hnext = bcache.ghash[h];
+  bcache.ghash[h] = g;
+}
+
+// Forget (dev, blockno) if it is remembered.
+// Returns 1 if it was. Caller must hold bcache.lock.
+static int
+gforget(uint dev, uint blockno)
+{
+  struct ghost *g;
+
+  for(g = bcache.ghash[bhash(dev, blockno)]; g; g = g->hnext){
+    if(g->dev == dev && g->blockno == blockno){
+      gunhash(g);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Give group g the data page pa, and put its buffers
+// at the end of "in" where they will be used first.
+// Caller must hold bcache.lock.
+static void
+battach(struct buf *g, char *pa)
+{
+  struct buf *b;
+
+  for(b = g; b < g+BPG; b++){
+    b->data = (uchar*)pa + (b - g) * BSIZE;
+    b->dev = -1;
+    b->blockno = -1;
+    b->valid = 0;
+    b->refcnt = 0;
+    b->meta = 0;
+    blink(b, 0, 0);
+  }
+  bcache.ngroup++;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *hdrs, *g, *b;
+  struct ghost *gh;
+  char *pa;
+  int i, n, gph;
 
   initlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Create the (empty) queues of buffers
+  bcache.in.prev = &bcache.in;
+  bcache.in.next = &bcache.in;
+  bcache.hot.prev = &bcache.hot;
+  bcache.hot.next = &bcache.hot;
+  for(gh = bcache.ghost; gh < bcache.ghost+NGHOST; gh++)
+    gh->dev = -1;
+
+  // Groups of buffer headers fill whole pages.
+  gph = PGSIZE / (BPG * sizeof(struct buf));
+  n = (PHYSTOP - (uint64)end) / BCACHEFRAC / (PGSIZE + BPG * sizeof(struct buf));
+  if(n < NBUF / BPG)
+    n = NBUF / BPG;
+
+  hdrs = 0;
+  for(i = 0; i < n; i++){
+    if(i % gph == 0 && (hdrs = kalloc()) == 0)
+      break;
+    g = hdrs + (i % gph) * BPG;
+    memset(g, 0, BPG * sizeof(struct buf));
+    for(b = g; b < g+BPG; b++)
+      initsleeplock(&b->lock, "buffer");
+    if((pa = kalloc()) == 0){
+      g->next = bcache.spare;
+      bcache.spare = g;
+      continue;
+    }
+    acquire(&bcache.lock);
+    battach(g, pa);
+    release(&bcache.lock);
   }
+  if(bcache.ngroup < NBUF / BPG)
+    panic("binit");
+}
+
+// Blocks of dev before metaend hold file system metadata.
+void
+bsetmeta(uint dev, uint metaend)
+{
+  acquire(&bcache.lock);
+  bcache.metadev = dev;
+  bcache.metaend = metaend;
+  release(&bcache.lock);
+}
+
+// Give a spare group of buffers a data page, if there is a
+// spare group and a free page. Returns 0 if out of memory.
+static int
+bgrow(void)
+{
+  char *pa;
+  struct buf *g;
+
+  if((pa = kalloc()) == 0)
+    return 0;
+  acquire(&bcache.lock);
+  if((g = bcache.spare) == 0){
+    // another process regrew the cache first.
+    release(&bcache.lock);
+    kfree(pa);
+    return 1;
+  }
+  bcache.spare = g->next;
+  battach(g, pa);
+  release(&bcache.lock);
+  return 1;
+}
+
+// Called by kalloc() when it is out of memory. Free the data page
+// of the least recently used group whose buffers are all unused.
+// Returns 1 if it freed a page, 0 if there is none to free.
+int
+bshrink(void)
+{
+  struct buf *q, *b, *g;
+  char *pa;
+  int i, k;
+
+  acquire(&bcache.lock);
+  if(bcache.ngroup <= NBUF / BPG){
+    release(&bcache.lock);
+    return 0;
+  }
+  for(k = 0; k < 2; k++){
+    q = k == 0 ? &bcache.in : &bcache.hot;
+    for(b = q->prev; b != q; b = b->prev){
+      if(b->refcnt != 0)
+        continue;
+      g = b - ((uint64)b->data % PGSIZE) / BSIZE;
+      for(i = 0; i < BPG; i++)
+        if(g[i].refcnt != 0)
+          break;
+      if(i < BPG)
+        continue;
+
+      pa = (char*)g->data;
+      for(i = 0; i < BPG; i++){
+        bunhash(&g[i]);
+        bunlink(&g[i]);
+        g[i].data = 0;
+      }
+      g->next = bcache.spare;
+      bcache.spare = g;
+      bcache.ngroup--;
+      release(&bcache.lock);
+      kfree(pa);
+      return 1;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Find the least recently used unused buffer in queue q,
+// skipping metadata unless meta is set.
+// Caller must hold bcache.lock.
+static struct buf*
+bunused(struct buf *q, int meta)
+{
+  struct buf *b;
+
+  for(b = q->prev; b != q; b = b->prev)
+    if(b->refcnt == 0 && (meta || b->meta == 0))
+      return b;
+  return 0;
+}
+
+// Choose an unused buffer to recycle, or return 0 if
+// every buffer is in use. Caller must hold bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b;
+
+  if(bcache.nin > bcache.ngroup * BPG / 4 && (b = bunused(&bcache.in, 0)))
+    return b;
+  if((b = bunused(&bcache.hot, 0)) || (b = bunused(&bcache.in, 0)))
+    return b;
+  return bunused(&bcache.hot, 1);
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,31 +363,68 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  uint h;
+  int hot;
 
+  h = bhash(dev, blockno);
   acquire(&bcache.lock);
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
+  for(;;){
+    // Is the block already cached?
+    for(b = bcache.hash[h]; b; b = b->hnext){
+      if(b->dev == dev && b->blockno == blockno){
+        b->refcnt++;
+        bcache.stat.hits++;
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
+    }
+
+    // Not cached.
+    // If the cache has shrunk and memory is free again, regrow it.
+    if(bcache.spare && kfreecount() > BMINFREE){
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      bgrow();
+      acquire(&bcache.lock);
+      continue;  // the block may have been cached meanwhile
     }
-  }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
+    // Recycle an unused buffer.
+    if((b = bvictim()) != 0){
+      bcache.stat.misses++;
+      if(b->valid){
+        bcache.stat.evictions++;
+        if(b->hot == 0 && b->meta == 0)
+          gremember(b->dev, b->blockno);
+      }
+      bunhash(b);
+      bunlink(b);
       b->dev = dev;
       b->blockno = blockno;
       b->valid = 0;
       b->refcnt = 1;
+      b->meta = (dev == bcache.metadev && blockno < bcache.metaend);
+      hot = b->meta;
+      if(gforget(dev, blockno)){
+        bcache.stat.ghosthits++;
+        hot = 1;
+      }
+      blink(b, hot, 1);
+      b->hnext = bcache.hash[h];
+      bcache.hash[h] = b;
       release(&bcache.lock);
       acquiresleep(&b->lock);
       return b;
     }
+
+    // Every buffer is in use; grow if allowed.
+    if(bcache.spare == 0)
+      break;
+    release(&bcache.lock);
+    if(bgrow() == 0)
+      break;
+    acquire(&bcache.lock);
   }
   panic("bget: no buffers");
 }
@@ -102,6 +443,18 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for a block that the caller will
+// overwrite entirely, without reading it from disk.
+struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->valid = 1;
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,8 +464,24 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write n locked buffers at once, bs[i] to block blocknos[i],
+// or to its own block if blocknos is 0. The writes may reach
+// the disk in any order.
+void
+bwritev(struct buf **bs, uint *blocknos, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  virtio_disk_rwv(bs, blocknos, n, 1);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// A buffer in "hot", or holding metadata, moves to the head of
+// "hot". A buffer in "in" keeps its place: the repeated reads
+// of a block while a file is read through are not reuse.
 void
 brelse(struct buf *b)
 {
@@ -123,14 +492,10 @@ brelse(struct buf *b)
 
   acquire(&bcache.lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
+  if (b->refcnt == 0 && (b->hot || b->meta)) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bunlink(b);
+    blink(b, 1, 1);
   }
   
   release(&bcache.lock);
@@ -150,4 +515,13 @@ bunpin(struct buf *b) {
   release(&bcache.lock);
 }
 
-
+// Copy the cache's counters to *st.
+void
+bstat(struct bcachestat *st)
+{
+  acquire(&bcache.lock);
+  *st = bcache.stat;
+  st->nbuf = bcache.ngroup * BPG;
+  st->nin = bcache.nin;
+  release(&bcache.lock);
+}
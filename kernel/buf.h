@@ -5,8 +5,11 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
+  int hot;     // in the "hot" queue, not "in"?
+  int meta;    // holds file system metadata?
   struct buf *prev; // LRU cache list
   struct buf *next;
-  uchar data[BSIZE];
+  struct buf *hnext; // hash chain
+  uchar *data;       // BSIZE bytes, in a page shared with its group
 };
 
@@ -17,10 +17,12 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "fcntl.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -50,6 +52,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct waitq wq;  // poll()s waiting for input
 } cons;
 
 //
@@ -58,13 +62,18 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
-
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  char buf[128];
+  int i, m;
+
+  // copy in a chunk at a time, and hand each
+  // chunk to the uart in one go.
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(buf))
+      m = sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    uartwrite(buf, m);
   }
 
   return i;
@@ -126,6 +135,24 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() of the console: readable once a whole
+// line (or end-of-file) has arrived.
+//
+int
+consolepoll(struct poller *pl)
+{
+  int ev;
+
+  pollwait(pl, &cons.wq);
+  acquire(&cons.lock);
+  ev = POLLOUT;
+  if(cons.r != cons.w)
+    ev |= POLLIN;
+  release(&cons.lock);
+  return ev;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -170,6 +197,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup(&cons.wq);
       }
     }
     break;
@@ -189,4 +217,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
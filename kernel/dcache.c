@@ -0,0 +1,189 @@
+// Directory name lookup cache.
+//
+// The dcache remembers the results of dirlookup(): it maps
+// (device, directory inum, name) to the inum of the matching
+// directory entry and the entry's byte offset in the directory.
+// It also remembers names that were looked for and not found
+// (negative entries, inum 0). A hit lets dirlookup(), and so
+// namex(), skip reading the directory's contents entirely.
+//
+// Entries for a directory are only created, changed, or dropped
+// by callers that hold that directory's inode lock, so a hit is
+// always consistent with the directory's contents:
+// * dirlookup() enters what it found (or didn't find).
+// * dirlink() enters the newly linked name.
+// * sys_unlink() turns the removed name into a negative entry.
+// * iput() purges every entry of a directory it frees, since
+//   the directory's inum may be reused.
+//
+// The cache is a fixed pool of NDCACHE entries, hashed on
+// (dev, dinum, name) and recycled in LRU order.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;           // inum of the directory
+  char name[DIRSIZ];
+  uint inum;            // 0 if name is not in the directory
+  uint off;             // byte offset of the entry, if inum != 0
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used, head.prev is least.
+  // Unused entries have dinum 0 and sit at the tail.
+  struct dentry head;
+} dcache;
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static uint
+dhash(uint dev, uint dinum, const char *name)
+{
+  return (namehash(name) + dinum * 31 + dev) % NDHASH;
+}
+
+// Find the entry for name in directory (dev, dinum).
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, const char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dinum, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dinum == dinum && namecmp(name, d->name) == 0)
+      return d;
+  return 0;
+}
+
+// Remove d from its hash chain and mark it unused.
+// Caller must hold dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dinum, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->hnext = 0;
+  d->dinum = 0;
+}
+
+// Move d to the head (used) or tail (unused) of the LRU list.
+// Caller must hold dcache.lock.
+static void
+dmove(struct dentry *d, int used)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  if(used){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+  } else {
+    d->next = &dcache.head;
+    d->prev = dcache.head.prev;
+  }
+  d->next->prev = d;
+  d->prev->next = d;
+}
+
+// Look up name in directory dp.
+// Returns 1 and sets *inum and *poff on a hit; *inum is 0
+// if the name is known not to exist. Returns 0 on a miss.
+// Caller must hold dp->lock.
+int
+dcachelookup(struct inode *dp, char *name, uint *inum, uint *poff)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  *poff = d->off;
+  dmove(d, 1);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum (0 if absent),
+// whose directory entry is at byte offset off.
+// Caller must hold dp->lock.
+void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->dinum)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dinum, d->name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dmove(d, 1);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory (dev, dinum).
+// Called when the directory's inode is freed.
+void
+dcachepurge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    if(d->dinum == dinum && d->dev == dev){
+      dunhash(d);
+      dmove(d, 0);
+    }
+  }
+  release(&dcache.lock);
+}
@@ -1,7 +1,15 @@
+struct bcachestat;
+struct kmemstat;
+struct kmem_cache;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct poller;
+struct pollfd;
+struct waitq;
+struct uring;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -14,14 +22,25 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+struct buf*     bclaim(uint, uint);
+void            bwritev(struct buf**, uint*, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bshrink(void);
+void            bsetmeta(uint, uint);
+void            bstat(struct bcachestat*);
 
 // console.c
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(struct inode*, char*, uint*, uint*);
+void            dcacheenter(struct inode*, char*, uint, uint);
+void            dcachepurge(uint, uint);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -29,10 +48,24 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+struct file*    fdget(struct proc*, int);
+int             fdinstall(struct proc*, struct file*);
+struct file*    fdremove(struct proc*, int);
+int             fdcopy(struct proc*, struct proc*);
+void            fdcloseall(struct proc*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filesend(struct file*, struct file*, int);
+int             filesplice(struct file*, struct file*, int);
+int             filevmsplice(struct file*, uint64, int);
+int             filecntl(struct file*, int, int);
+int             filepoll(struct file*, struct poller*);
+int             filesync(struct file*);
+int             filegetdents(struct file*, uint64, int, int);
 
 // fs.c
 void            fsinit(int);
@@ -47,10 +80,12 @@ void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
+uint            namehash(const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
+int             istat(uint, uint, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 
@@ -61,30 +96,55 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_order(int);
+void*           kalloc_zeroed(void);
 void            kfree(void *);
+void            kfree_order(void *, int);
 void            kinit(void);
+int             kfreecount(void);
+int             korder(uint64);
+int             kzeroidle(void);
+void            kstat(struct kmemstat*);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
+int             log_opmax(void);
+void            log_force(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, int, uint64, int, int);
+int             pipesize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
+int             pipevmsplice(struct pipe*, int, uint64, int, int);
+int             pipegetspan(struct pipe*, int, char**, int, int);
+void            pipeputspan(struct pipe*, int, int);
+int             pipepoll(struct pipe*, int, struct poller*);
 
 // printf.c
 void            printf(char*, ...);
 void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 
+// poll.c
+void            pollinit(void);
+void            pollwait(struct poller*, struct waitq*);
+void            pollwakeup(struct waitq*);
+void            polltick(void);
+int             dopoll(struct pollfd*, int, int);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             kthread(void (*)(void), char*);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -110,6 +170,9 @@ void            procdump(void);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// sysfile.c
+struct file*    fileopen(char*, int);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -124,6 +187,11 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// slab.c
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -152,6 +220,7 @@ void            usertrapret(void);
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
+void            uartwrite(char*, int);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -180,9 +249,17 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// uring.c
+void            ringinit(void);
+uint64          ringsetup(void);
+int             ringenter(int, int);
+void            ringcancel(struct proc*, uint64, uint64);
+void            ringexit(struct proc*);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwv(struct buf **, uint *, int, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
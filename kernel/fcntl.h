@@ -3,3 +3,35 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+#define O_NONBLOCK 0x800
+
+// read() and write() of an O_NONBLOCK descriptor return
+// -EAGAIN when they would otherwise have to wait.
+#define EAGAIN 11
+
+// fcntl() commands.
+#define F_GETPIPE_SZ 1  // get a pipe's capacity in bytes
+#define F_SETPIPE_SZ 2  // set a pipe's capacity to at least arg bytes
+#define F_GETFL      3  // get the access mode and O_NONBLOCK
+#define F_SETFL      4  // set O_NONBLOCK from arg
+
+// A segment of memory for readv() and writev().
+struct iovec {
+  void *iov_base;
+  uint64 iov_len;
+};
+
+#define IOV_MAX 16  // most segments in one readv() or writev()
+
+// A file descriptor for poll(), and the events to wait for.
+struct pollfd {
+  int fd;         // ignored if negative
+  short events;   // requested events
+  short revents;  // returned events
+};
+
+#define POLLIN   0x001  // there is data to read
+#define POLLOUT  0x004  // writing now will not block
+#define POLLERR  0x008  // error, such as a pipe with no reader
+#define POLLHUP  0x010  // a pipe with no writer
+#define POLLNVAL 0x020  // fd is not open
@@ -12,17 +12,22 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
 
 struct devsw devsw[NDEV];
+
+// Open files come from an object cache, so there is no limit
+// on them but memory. ftable.lock protects their ref counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -31,16 +36,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +69,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -82,6 +81,189 @@ fileclose(struct file *f)
   }
 }
 
+// Per-process file descriptor tables.
+//
+// p->ofile starts out as p->ofile0, room for NOFILE descriptors
+// in the proc itself, and doubles into a block from
+// kalloc_order() whenever the process needs more, up to
+// MAXOFILE. Bit fd of p->fdmap is set while descriptor fd is in
+// use, so the lowest free descriptor is the lowest clear bit,
+// found a word at a time. p->fdlock protects the table, since
+// a ring worker may install a descriptor for p while p runs.
+
+// Index of the lowest set bit of x, which must not be 0.
+static int
+lowbit(uint64 x)
+{
+  int n, s;
+
+  n = 0;
+  for(s = 32; s > 0; s >>= 1){
+    if((x & ((1UL << s) - 1)) == 0){
+      n += s;
+      x >>= s;
+    }
+  }
+  return n;
+}
+
+// Caller must hold p->fdlock.
+static void
+fdset(struct proc *p, int fd, struct file *f)
+{
+  p->ofile[fd] = f;
+  if(f)
+    p->fdmap[fd/64] |= 1UL << (fd%64);
+  else
+    p->fdmap[fd/64] &= ~(1UL << (fd%64));
+}
+
+// Free t, a table of n slots, unless it is p->ofile0.
+static void
+fdfreetable(struct proc *p, struct file **t, int n)
+{
+  if(t && t != p->ofile0)
+    kfree_order(t, korder(n * sizeof(*t)));
+}
+
+// The file open as descriptor fd in p, or 0.
+struct file*
+fdget(struct proc *p, int fd)
+{
+  struct file *f;
+
+  if(fd < 0 || fd >= MAXOFILE)
+    return 0;
+  acquire(&p->fdlock);
+  f = fd < p->nofile ? p->ofile[fd] : 0;
+  release(&p->fdlock);
+  return f;
+}
+
+// Allocate the lowest free file descriptor in p for f.
+// Takes over the caller's reference to f on success.
+int
+fdinstall(struct proc *p, struct file *f)
+{
+  struct file **t, **old;
+  int fd, i, n, oldn;
+
+  t = 0;
+  n = 0;
+  acquire(&p->fdlock);
+  for(;;){
+    for(i = 0; i < NELEM(p->fdmap) && p->fdmap[i] == ~0UL; i++)
+      ;
+    if(i == NELEM(p->fdmap)){
+      fd = -1;
+      break;
+    }
+    fd = 64*i + lowbit(~p->fdmap[i]);
+    if(fd < p->nofile){
+      fdset(p, fd, f);
+      break;
+    }
+
+    // The table is full: double it, with a table allocated
+    // while not holding the lock.
+    if(t && n == 2 * p->nofile){
+      memmove(t, p->ofile, p->nofile * sizeof(*t));
+      memset(t + p->nofile, 0, p->nofile * sizeof(*t));
+      old = p->ofile;
+      oldn = p->nofile;
+      p->ofile = t;
+      p->nofile = n;
+      t = old;
+      n = oldn;
+      continue;
+    }
+    oldn = p->nofile;
+    release(&p->fdlock);
+    fdfreetable(p, t, n);
+    n = 2 * oldn;
+    t = kalloc_order(korder(n * sizeof(*t)));
+    acquire(&p->fdlock);
+    if(t == 0){
+      fd = -1;
+      break;
+    }
+  }
+  release(&p->fdlock);
+  fdfreetable(p, t, n);
+  return fd;
+}
+
+// Take descriptor fd out of p's table.
+// Returns the file it referred to, or 0.
+struct file*
+fdremove(struct proc *p, int fd)
+{
+  struct file *f;
+
+  if(fd < 0 || fd >= MAXOFILE)
+    return 0;
+  f = 0;
+  acquire(&p->fdlock);
+  if(fd < p->nofile && (f = p->ofile[fd]) != 0)
+    fdset(p, fd, 0);
+  release(&p->fdlock);
+  return f;
+}
+
+// Give np, a new child of p, copies of p's descriptors.
+// np isn't running yet, so its table needs no lock.
+// Returns -1 if there is no memory for the table, leaving
+// np with its empty p->ofile0.
+int
+fdcopy(struct proc *np, struct proc *p)
+{
+  struct file **t;
+  int fd, n;
+
+  acquire(&p->fdlock);
+  while(p->nofile > np->nofile){
+    n = p->nofile;
+    release(&p->fdlock);
+    if((t = kalloc_order(korder(n * sizeof(*t)))) == 0){
+      // np has a table from an earlier try if p's grew meanwhile.
+      fdfreetable(np, np->ofile, np->nofile);
+      np->ofile = np->ofile0;
+      np->nofile = NOFILE;
+      return -1;
+    }
+    memset(t, 0, n * sizeof(*t));
+    fdfreetable(np, np->ofile, np->nofile);
+    np->ofile = t;
+    np->nofile = n;
+    acquire(&p->fdlock);
+  }
+  for(fd = 0; fd < p->nofile; fd++)
+    if(p->ofile[fd])
+      fdset(np, fd, filedup(p->ofile[fd]));
+  release(&p->fdlock);
+  return 0;
+}
+
+// Close all of p's descriptors, and go back to p->ofile0.
+// Called by exit(), once p's ring requests are finished.
+void
+fdcloseall(struct proc *p)
+{
+  struct file **t, *f;
+  int fd, n;
+
+  for(fd = 0; fd < p->nofile; fd++)
+    if((f = fdremove(p, fd)) != 0)
+      fileclose(f);
+  acquire(&p->fdlock);
+  t = p->ofile;
+  n = p->nofile;
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+  release(&p->fdlock);
+  fdfreetable(p, t, n);
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int
@@ -101,6 +283,17 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Make f's updates durable: commit the log, which holds
+// the file's data and metadata alike.
+int
+filesync(struct file *f)
+{
+  if(f->type != FD_INODE)
+    return -1;
+  log_force();
+  return 0;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -112,10 +305,13 @@ fileread(struct file *f, uint64 addr, int n)
     return -1;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
+    if(f->nonblock && devsw[f->major].poll &&
+       (devsw[f->major].poll(0) & POLLIN) == 0)
+      return -EAGAIN;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
@@ -129,54 +325,407 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
-// addr is a user virtual address.
+// Read the entries of directory f into n bytes at user address
+// addr, skipping free slots. Fills struct dirent records, or
+// struct direntstat records if flags has GD_STAT.
+// Returns the number of bytes filled in; 0 at end of directory.
 int
-filewrite(struct file *f, uint64 addr, int n)
+filegetdents(struct file *f, uint64 addr, int n, int flags)
+{
+  struct proc *p = myproc();
+  struct dirent de[16];
+  struct direntstat ds;
+  int i, m, sz, tot;
+  char *rec;
+
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  sz = (flags & GD_STAT) ? sizeof(ds) : sizeof(de[0]);
+
+  ilock(f->ip);
+  if(f->ip->type != T_DIR){
+    iunlock(f->ip);
+    return -1;
+  }
+  tot = 0;
+  while(tot + sz <= n){
+    m = readi(f->ip, 0, (uint64)de, f->off, sizeof(de)) / sizeof(de[0]);
+    if(m <= 0)
+      break;
+    for(i = 0; i < m && tot + sz <= n; i++){
+      rec = (char*)&de[i];
+      if(de[i].inum != 0 && (flags & GD_STAT)){
+        ds.inum = de[i].inum;
+        memmove(ds.name, de[i].name, DIRSIZ);
+        rec = (char*)&ds;
+        if(istat(f->ip->dev, de[i].inum, &ds.st) < 0)
+          rec = 0;  // removed since the entry was read
+      }
+      if(de[i].inum != 0 && rec){
+        if(copyout(p->pagetable, addr + tot, rec, sz) < 0){
+          iunlock(f->ip);
+          return -1;
+        }
+        tot += sz;
+      }
+      f->off += sizeof(de[0]);
+    }
+  }
+  iunlock(f->ip);
+
+  return tot;
+}
+
+// Read from f into the cnt segments of iov, at user addresses.
+// If off is -1, read at f's offset and advance it; otherwise
+// read at off and leave f's offset alone. An inode is locked
+// once for all the segments.
+// Returns the number of bytes read, or -1.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt, int off)
+{
+  int i, r, tot;
+  uint o;
+
+  if(f->readable == 0)
+    return -1;
+
+  tot = 0;
+  if(f->type != FD_INODE){
+    if(off != -1)
+      return -1;  // pipes and devices have no offset
+    // only wait for the first data: later segments of a pipe
+    // take only what is already there, and a device gets no
+    // more reads once one has returned data.
+    for(i = 0; i < cnt; i++){
+      if(tot > 0 && f->type == FD_PIPE)
+        r = piperead(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len, 1);
+      else
+        r = fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r < 0)
+        return tot > 0 ? tot : r;
+      tot += r;
+      if(r < iov[i].iov_len || (f->type == FD_DEVICE && tot > 0))
+        break;
+    }
+    return tot;
+  }
+
+  ilock(f->ip);
+  o = (off == -1) ? f->off : off;
+  for(i = 0; i < cnt; i++){
+    if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, o, iov[i].iov_len)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    o += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  if(off == -1)
+    f->off = o;
+  iunlock(f->ip);
+
+  return tot;
+}
+
+// Write the cnt segments of iov to inode file f, at off or,
+// if off is -1, at f's offset. The segments are at user
+// addresses if user_src is 1, else at kernel addresses.
+// write as many blocks at a time as one log operation
+// may reserve, counting the i-node, indirect block,
+// allocation blocks, and 2 blocks of slop for
+// non-aligned writes; one transaction may take in
+// several segments, under one lock of the inode.
+// Returns the number of bytes written, or -1.
+static int
+writeiv(struct file *f, int user_src, struct iovec *iov, int cnt, int off)
+{
+  int max = ((log_opmax()-1-1-2) / 2) * BSIZE;
+  int i, done, n, n1, m, r, tot, total;
+  uint o;
+
+  total = 0;
+  for(i = 0; i < cnt; i++){
+    if((int)iov[i].iov_len < 0 || total + (int)iov[i].iov_len < total)
+      return -1;
+    total += iov[i].iov_len;
+  }
+
+  i = 0;
+  done = 0;
+  tot = 0;
+  o = off;
+  while(tot < total){
+    n = total - tot;
+    if(n > max)
+      n = max;
+
+    begin_opn(1+1+2 + 2*((n+BSIZE-1)/BSIZE));
+    ilock(f->ip);
+    if(off == -1)
+      o = f->off;
+    for(n1 = 0; n1 < n; ){
+      while(done == iov[i].iov_len){
+        i++;
+        done = 0;
+      }
+      m = iov[i].iov_len - done;
+      if(m > n - n1)
+        m = n - n1;
+      if((r = writei(f->ip, user_src, (uint64)iov[i].iov_base + done, o, m)) > 0){
+        o += r;
+        done += r;
+        n1 += r;
+      }
+      if(r != m)
+        break;
+    }
+    if(off == -1)
+      f->off = o;
+    iunlock(f->ip);
+    end_op();
+
+    tot += n1;
+    if(n1 != n){
+      // error from writei
+      return -1;
+    }
+  }
+  return tot;
+}
+
+// Write the cnt segments of iov, at user addresses, to f.
+// If off is -1, write at f's offset and advance it; otherwise
+// write at off and leave f's offset alone.
+// Returns the number of bytes written, or -1.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt, int off)
 {
-  int r, ret = 0;
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+
+  if(f->type == FD_INODE)
+    return writeiv(f, 1, iov, cnt, off);
+
+  if(off != -1)
+    return -1;  // pipes and devices have no offset
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if((r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len)) < 0)
+      return tot > 0 ? tot : r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  return tot;
+}
+
+// Write n bytes at addr to file f, where addr is a user
+// virtual address if user_src is 1, else a kernel address.
+static int
+writeto(struct file *f, int user_src, uint64 addr, int n)
+{
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n, f->nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
+    struct iovec iov;
+    iov.iov_base = (void*)addr;
+    iov.iov_len = n;
+    ret = writeiv(f, user_src, &iov, 1, -1);
+  } else {
+    panic("filewrite");
+  }
+
+  return ret;
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  return writeto(f, 1, addr, n);
+}
+
+// Copy up to n bytes from inode file in, at its offset, to
+// file out, without passing through user space.
+// Data for a pipe goes straight into the pipe's buffer;
+// otherwise it moves a page at a time through a kernel
+// buffer: holding the source's cache blocks instead, while
+// the write waits for log space, could deadlock against
+// the log's checkpoint.
+// Returns the number of bytes copied, or -1.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  char *buf;
+  int r = 0, w = 0, m, tot;
+
+  if(in->readable == 0 || in->type != FD_INODE || out->writable == 0)
+    return -1;
+  if(out->type == FD_INODE && out->ip == in->ip)
+    return -1;
+  if(out->type == FD_PIPE)
+    return filesplice(in, out, n);
+  if((buf = kalloc()) == 0)
+    return -1;
+
+  tot = 0;
+  while(tot < n){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    ilock(in->ip);
+    r = readi(in->ip, 0, (uint64)buf, in->off, m);
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+    w = writeto(out, 0, (uint64)buf, r);
+    if(w > 0){
+      ilock(in->ip);
+      in->off += w;
+      iunlock(in->ip);
+      tot += w;
+    }
+    if(w != r)
+      break;
+  }
+  kfree(buf);
+
+  if(tot == 0 && (r < 0 || w < 0))
+    return -1;
+  return tot;
+}
+
+// Move up to n bytes from in to out, where one of them is a
+// pipe and the other a file or device, straight through the
+// pipe's buffer without a user-space copy. An O_NONBLOCK
+// pipe makes it return -EAGAIN rather than wait.
+// Returns the number of bytes moved, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *p;
+  int m, r, tot;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+
+  tot = 0;
+  if(in->type == FD_PIPE && out->type != FD_PIPE){
+    // like read(), wait only until there is some data.
+    while(tot < n){
+      if((m = pipegetspan(in->pipe, 0, &p, n - tot, in->nonblock || tot > 0)) <= 0){
+        if(m < 0 && tot == 0)
+          tot = m == -EAGAIN ? m : -1;
+        break;
+      }
+      r = writeto(out, 0, (uint64)p, m);
+      pipeputspan(in->pipe, 0, r > 0 ? r : 0);
+      if(r > 0)
+        tot += r;
+      if(r != m){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+    }
+  } else if(in->type == FD_INODE && out->type == FD_PIPE){
+    while(tot < n){
+      if((m = pipegetspan(out->pipe, 1, &p, n - tot, out->nonblock)) <= 0){
+        if(tot == 0)
+          tot = m == -EAGAIN ? m : -1;
         break;
       }
-      i += r;
+      ilock(in->ip);
+      if((r = readi(in->ip, 0, (uint64)p, in->off, m)) > 0)
+        in->off += r;
+      iunlock(in->ip);
+      pipeputspan(out->pipe, 1, r > 0 ? r : 0);
+      if(r < 0 && tot == 0)
+        tot = -1;
+      if(r <= 0)
+        break;
+      tot += r;
     }
-    ret = (i == n ? n : -1);
   } else {
-    panic("filewrite");
+    return -1;
   }
+  return tot;
+}
 
-  return ret;
+// Move n bytes between pipe f and user memory at addr,
+// trading whole pages instead of copying where they line up.
+int
+filevmsplice(struct file *f, uint64 addr, int n)
+{
+  if(f->type != FD_PIPE)
+    return -1;
+  return pipevmsplice(f->pipe, f->writable, addr, n, f->nonblock);
+}
+
+// Return the poll() events ready on f, and put poll() pl,
+// if any, on the wait queue for f's object.
+int
+filepoll(struct file *f, struct poller *pl)
+{
+  int ev = 0;
+
+  if(f->type == FD_PIPE){
+    ev = pipepoll(f->pipe, f->writable, pl);
+  } else if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV)
+      return POLLERR;
+    if(devsw[f->major].poll)
+      ev = devsw[f->major].poll(pl);
+    else
+      ev = POLLIN | POLLOUT;
+  } else if(f->type == FD_INODE){
+    // files never make a reader or writer wait.
+    ev = POLLIN | POLLOUT;
+  }
+  if(!f->readable)
+    ev &= ~POLLIN;
+  if(!f->writable)
+    ev &= ~POLLOUT;
+  return ev;
+}
+
+// Carry out fcntl() command cmd on f.
+int
+filecntl(struct file *f, int cmd, int arg)
+{
+  switch(cmd){
+  case F_GETFL:
+    return (f->readable && f->writable ? O_RDWR : f->writable ? O_WRONLY : O_RDONLY) |
+      (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    // only O_NONBLOCK can be changed.
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesetsize(f->pipe, arg);
+  }
+  return -1;
 }
 
@@ -3,6 +3,7 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: fail with -EAGAIN, don't wait
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
@@ -18,6 +19,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -29,10 +31,13 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
+struct poller;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct poller*);  // ready events; may be 0
 };
 
 extern struct devsw devsw[];
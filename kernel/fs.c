@@ -43,6 +43,8 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  // everything before the first data block is metadata.
+  bsetmeta(dev, sb.bmapstart + sb.size/BPB + 1);
   initlog(dev, &sb);
 }
 
@@ -129,18 +131,17 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to an entry in the inode table (open
 //   files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref, and frees the entry when it reaches zero.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid; a new entry starts with
+//   ip->valid clear.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,29 +165,38 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table has no fixed size: iget() allocates an entry from
+// an object cache and hashes it on (dev, inum), and iput()
+// frees it when the last reference goes away.
+//
+// The itable.lock spin-lock protects the hash chains. Since
+// ip->ref indicates whether an entry is in use, and ip->dev and
+// ip->inum indicate which i-node an entry holds, one must hold
+// itable.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct inode *hash[NIHASH];
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  itable.cache = kmem_cache_create("inode", sizeof(struct inode));
+}
+
+static uint
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIHASH;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -246,31 +256,42 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, *new;
+  uint h;
 
+  h = ihash(dev, inum);
+  new = 0;
   acquire(&itable.lock);
-
-  // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
+  for(;;){
+    // Is the inode already in the table?
+    for(ip = itable.hash[h]; ip; ip = ip->hnext){
+      if(ip->dev == dev && ip->inum == inum){
+        ip->ref++;
+        release(&itable.lock);
+        if(new)
+          kmem_cache_free(itable.cache, new);
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
+    if(new)
+      break;
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    // Allocate an entry without the lock held, then look
+    // again, since another process may have added the inode.
+    release(&itable.lock);
+    if((new = kmem_cache_alloc(itable.cache)) == 0)
+      panic("iget: no inodes");
+    initsleeplock(&new->lock, "inode");
+    acquire(&itable.lock);
+  }
 
-  ip = empty;
+  ip = new;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = itable.hash[h];
+  itable.hash[h] = ip;
   release(&itable.lock);
 
   return ip;
@@ -327,8 +348,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -336,6 +357,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquire(&itable.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
@@ -348,6 +371,8 @@ iput(struct inode *ip)
     release(&itable.lock);
 
     itrunc(ip);
+    if(ip->type == T_DIR)
+      dcachepurge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
@@ -357,8 +382,18 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref > 0){
+    release(&itable.lock);
+    return;
+  }
+  for(pp = &itable.hash[ihash(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+  }
   release(&itable.lock);
+  kmem_cache_free(itable.cache, ip);
 }
 
 // Common idiom: unlock, then put.
@@ -405,6 +440,7 @@ bmap(struct inode *ip, uint bn)
       ip->addrs[NDIRECT] = addr;
     }
     bp = bread(ip->dev, addr);
+    bp->meta = 1;
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
       addr = balloc(ip->dev);
@@ -464,6 +500,32 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Copy stat information for inode inum on device dev
+// straight from its on-disk inode, without taking the
+// inode's lock. Returns -1 if the inode is free.
+int
+istat(uint dev, uint inum, struct stat *st)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  int r = -1;
+
+  if(inum == 0 || inum >= sb.ninodes)
+    return -1;
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0){
+    st->dev = dev;
+    st->ino = inum;
+    st->type = dip->type;
+    st->nlink = dip->nlink;
+    st->size = dip->size;
+    r = 0;
+  }
+  brelse(bp);
+  return r;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -539,6 +601,29 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 }
 
 // Directories
+//
+// A directory is an array of struct dirent; free slots have inum 0.
+// Directories made by mkfs are linear: lookups and inserts scan
+// every entry. Directories made by mkdir() are hashed (the inode's
+// major field is DIR_HASHED): each data block is a bucket of a
+// linear hash table keyed by namehash(). With nb buckets and
+// lvl the largest power of two <= nb, a name with hash h lives in
+// bucket h mod lvl, or in h mod 2*lvl if the former is below
+// nb - lvl, the split pointer. Adding bucket nb splits bucket
+// nb - lvl, so the table grows one block at a time and an insert
+// touches a bounded number of blocks.
+//
+// A hashed directory is still an array of dirents, so anything
+// that scans it linearly (isdirempty(), user programs that read()
+// directories) keeps working. "." and ".." always occupy the first
+// two slots of bucket 0. The last slot of every bucket has inum 0,
+// so scanners skip it, and holds the bucket's flags in name[0]:
+// DHB_OVERFLOW means some entry that hashes to this bucket had to
+// be stored in another one, so a failed lookup must scan them all.
+// To keep that rare, an insert splits a bucket as soon as it finds
+// its home bucket holding DHSPLIT entries, rather than when full.
+
+#define DHSPLIT 56
 
 int
 namecmp(const char *s, const char *t)
@@ -546,32 +631,248 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// FNV-1a hash of a directory entry name (at most DIRSIZ bytes).
+uint
+namehash(const char *s)
+{
+  uint h = 2166136261;
+  int i;
+
+  for(i = 0; i < DIRSIZ && s[i]; i++){
+    h ^= (uchar)s[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Bucket for hash h in a hashed directory with nb buckets.
+static uint
+dbucket(uint h, uint nb)
+{
+  uint lvl;
+
+  for(lvl = 1; lvl*2 <= nb; lvl *= 2)
+    ;
+  if((h & (lvl-1)) < nb - lvl)
+    return h & (2*lvl-1);
+  return h & (lvl-1);
+}
+
+// Read block bn of directory dp.
+static struct buf*
+dread(struct inode *dp, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if((addr = bmap(dp, bn)) == 0)
+    panic("dread");
+  bp = bread(dp->dev, addr);
+  bp->meta = 1;
+  return bp;
+}
+
+// Look for name in block bn of directory dp.
+// If found, set *pinum and *poff and return 1.
+// If pflags != 0, set *pflags to the bucket's flags.
+static int
+dscan(struct inode *dp, uint bn, char *name, uint *pinum, uint *poff, uint *pflags)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint off;
+  int found = 0;
+
+  bp = dread(dp, bn);
+  de = (struct dirent*)bp->data;
+  for(off = bn*BSIZE; off < (bn+1)*BSIZE && off < dp->size; off += sizeof(*de), de++){
+    if(de->inum != 0 && namecmp(name, de->name) == 0){
+      *pinum = de->inum;
+      *poff = off;
+      found = 1;
+      break;
+    }
+  }
+  if(pflags)
+    *pflags = ((struct dirent*)bp->data)[DPB-1].name[0];
+  brelse(bp);
+  return found;
+}
+
+// Find a free slot in block bn of directory dp, not counting
+// the first skip slots or a hashed directory's flags slot.
+// Returns the slot's byte offset, or -1 if there is none.
+// If pn != 0, sets *pn to the number of entries in use.
+static int
+dfree(struct inode *dp, uint bn, int skip, int *pn)
+{
+  struct buf *bp;
+  struct dirent *de;
+  int i, n, off, used;
+
+  n = (dp->major == DIR_HASHED) ? DPB-1 : DPB;
+  off = -1;
+  used = 0;
+  bp = dread(dp, bn);
+  de = (struct dirent*)bp->data;
+  for(i = skip; i < n && bn*BSIZE + i*sizeof(*de) < dp->size; i++){
+    if(de[i].inum != 0)
+      used++;
+    else if(off < 0)
+      off = bn*BSIZE + i*sizeof(*de);
+    if(off >= 0 && pn == 0)
+      break;
+  }
+  brelse(bp);
+  if(pn)
+    *pn = used;
+  return off;
+}
+
+// Set flags on bucket bn of hashed directory dp.
+static void
+dsetflags(struct inode *dp, uint bn, uint flags)
+{
+  struct buf *bp;
+
+  bp = dread(dp, bn);
+  ((struct dirent*)bp->data)[DPB-1].name[0] |= flags;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Add a bucket to hashed directory dp, moving into it the entries
+// of the bucket it splits. Returns the split bucket's number,
+// or -1 if out of disk space.
+static int
+dsplit(struct inode *dp)
+{
+  uint nb, lvl, s;
+  struct buf *sbp, *nbp;
+  struct dirent *sde, *nde;
+  int i, j;
+
+  nb = dp->size / BSIZE;
+  if(nb >= MAXFILE || bmap(dp, nb) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  if(nb == 0)
+    return 0;
+
+  for(lvl = 1; lvl*2 <= nb; lvl *= 2)
+    ;
+  s = nb - lvl;
+  sbp = dread(dp, s);
+  nbp = dread(dp, nb);
+  sde = (struct dirent*)sbp->data;
+  nde = (struct dirent*)nbp->data;
+  j = 0;
+  for(i = (s == 0 ? 2 : 0); i < DPB-1; i++){
+    if(sde[i].inum == 0 || dbucket(namehash(sde[i].name), nb+1) != nb)
+      continue;
+    nde[j] = sde[i];
+    dcacheenter(dp, nde[j].name, nde[j].inum, nb*BSIZE + j*sizeof(*nde));
+    memset(&sde[i], 0, sizeof(sde[i]));
+    j++;
+  }
+  // Entries that overflowed from bucket s may now belong in nb.
+  nde[DPB-1].name[0] = sde[DPB-1].name[0];
+  log_write(sbp);
+  log_write(nbp);
+  brelse(sbp);
+  brelse(nbp);
+  return s;
+}
+
+// Choose the slot for a new entry name in hashed directory dp.
+// Returns the slot's byte offset, or -1 if there is none.
+static int
+dhslot(struct inode *dp, char *name)
+{
+  int off, s, n;
+  uint b, nb;
+
+  if(dp->size == 0 && dsplit(dp) < 0)
+    return -1;
+  if(namecmp(name, ".") == 0)
+    return 0;
+  if(namecmp(name, "..") == 0)
+    return sizeof(struct dirent);
+
+  b = dbucket(namehash(name), dp->size / BSIZE);
+  off = dfree(dp, b, b == 0 ? 2 : 0, &n);
+  if(off >= 0 && n < DHSPLIT)
+    return off;
+
+  // The home bucket is getting full; grow the table by one bucket.
+  if((s = dsplit(dp)) >= 0){
+    nb = dp->size / BSIZE;
+    b = dbucket(namehash(name), nb);
+    if((off = dfree(dp, b, b == 0 ? 2 : 0, 0)) >= 0)
+      return off;
+    // Still full. The split left room in the new bucket or
+    // in bucket s; store the entry there and mark its home.
+    dsetflags(dp, b, DHB_OVERFLOW);
+    if((off = dfree(dp, nb-1, 0, 0)) >= 0 || (off = dfree(dp, s, s == 0 ? 2 : 0, 0)) >= 0)
+      return off;
+  } else if(off >= 0){
+    // Can't grow (directory at MAXFILE or disk full),
+    // but the home bucket still has room.
+    return off;
+  }
+
+  dsetflags(dp, b, DHB_OVERFLOW);
+  nb = dp->size / BSIZE;
+  for(b = 0; b < nb; b++)
+    if((off = dfree(dp, b, b == 0 ? 2 : 0, 0)) >= 0)
+      return off;
+  return -1;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Consults the name cache first, and records the outcome
+// of a directory search in it.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  uint off, inum, nb, b, bn, flags;
+  int found;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
-    }
+  if(dcachelookup(dp, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
   }
 
-  return 0;
+  nb = (dp->size + BSIZE - 1) / BSIZE;
+  found = 0;
+  flags = DHB_OVERFLOW;
+  if(dp->major == DIR_HASHED && nb > 0){
+    if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+      b = 0;
+    else
+      b = dbucket(namehash(name), nb);
+    found = dscan(dp, b, name, &inum, &off, &flags);
+  }
+  for(bn = 0; !found && (flags & DHB_OVERFLOW) && bn < nb; bn++)
+    found = dscan(dp, bn, name, &inum, &off, 0);
+
+  if(!found){
+    dcacheenter(dp, name, 0, 0);
+    return 0;
+  }
+  // entry matches path element
+  if(poff)
+    *poff = off;
+  dcacheenter(dp, name, inum, off);
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -580,6 +881,7 @@ int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
+  uint bn;
   struct dirent de;
   struct inode *ip;
 
@@ -589,18 +891,24 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  if(dp->major == DIR_HASHED){
+    if((off = dhslot(dp, name)) < 0)
+      return -1;
+  } else {
+    // Look for an empty dirent, else append.
+    off = -1;
+    for(bn = 0; off < 0 && bn*BSIZE < dp->size; bn++)
+      off = dfree(dp, bn, 0, 0);
+    if(off < 0)
+      off = dp->size;
   }
 
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
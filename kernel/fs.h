@@ -38,6 +38,28 @@ struct dinode {
   uint addrs[NDIRECT+1];   // Data block addresses
 };
 
+// The log (see log.c) starts with a block holding a struct
+// loghead. Records follow it: a struct logdesc block, then the
+// n blocks it lists. The records of one transaction share a
+// sequence number, and the last one has LD_COMMIT set. sum
+// covers the descriptor (with sum 0) and the record's blocks.
+struct loghead {
+  uint seq;          // sequence number of the first transaction
+};
+
+#define LOGMAGIC 0x6c6f6721
+#define LD_COMMIT 0x1
+#define LOGDPB ((BSIZE - 5*sizeof(uint)) / sizeof(uint))
+
+struct logdesc {
+  uint magic;        // Must be LOGMAGIC
+  uint seq;          // Transaction sequence number
+  uint flags;        // LD_COMMIT on a transaction's last record
+  uint n;            // Number of blocks in this record
+  uint sum;          // Checksum of the record
+  uint block[LOGDPB]; // Their home block numbers
+};
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -58,3 +80,13 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory whose inode has major == DIR_HASHED keeps its
+// entries in hash buckets, one per block; see fs.c.
+// The last entry of each bucket has inum 0 and holds the
+// bucket's flags in name[0].
+#define DIR_HASHED    1
+#define DHB_OVERFLOW  0x1  // an entry hashing here is in another bucket
+
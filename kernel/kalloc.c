@@ -1,6 +1,14 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates blocks of 2^order
+// physically contiguous 4096-byte pages.
+//
+// It is a binary buddy allocator. Every block is aligned to its
+// own size, so the block of the same order that it pairs with,
+// its buddy, differs from it in one bit of the page number.
+// A request splits a larger free block in halves as often as
+// needed, and a freed block merges with its buddy, and the
+// result with its buddy, for as long as the buddies are free.
 
 #include "types.h"
 #include "param.h"
@@ -8,75 +16,340 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
-
-void freerange(void *pa_start, void *pa_end);
+#include "stat.h"
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+#define NPAGE ((PHYSTOP - KERNBASE) / PGSIZE)
+
+// Most pages the idle loop keeps zeroed. They sit outside
+// the buddy lists, so they are also pages that can't merge.
+#define NZEROED 256
+
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// Besides the free blocks of each order, there is a list of
+// single pages that the idle loop has already cleared (see
+// kzeroidle()). kalloc() takes from the buddy lists first,
+// saving the zeroed pages for kalloc_zeroed().
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1];   // free blocks of each order
+  int nblock[MAXORDER+1];         // how many on each list
+  uchar order[NPAGE];             // 1 + order of the free block
+                                  // starting at each page, or 0
+  struct run *zeroed;
+  int nzeroed;
+  int nfree;                      // free pages, zeroed included
 } kmem;
 
+static int
+pgnum(void *pa)
+{
+  return ((uint64)pa - KERNBASE) / PGSIZE;
+}
+
+static struct run*
+pgaddr(int i)
+{
+  return (struct run*)(KERNBASE + (uint64)i * PGSIZE);
+}
+
+// Put the free block at page i, of order k, on its list.
+// Caller must hold kmem.lock.
+static void
+pushblock(int i, int k)
+{
+  struct run *r = pgaddr(i);
+
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  kmem.order[i] = k + 1;
+  kmem.nblock[k]++;
+}
+
+// Take the free block at page i, of order k, off its list.
+// Caller must hold kmem.lock.
+static void
+pullblock(int i, int k)
+{
+  struct run *r = pgaddr(i);
+
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.order[i] = 0;
+  kmem.nblock[k]--;
+}
+
+// Free the block at page i, of order k, merging it with
+// its buddies. Caller must hold kmem.lock.
+static void
+freeblock(int i, int k)
+{
+  int b;
+
+  for(; k < MAXORDER; k++){
+    b = i ^ (1 << k);
+    if(b >= NPAGE || kmem.order[b] != k + 1)
+      break;
+    pullblock(b, k);
+    i &= b;   // the lower of the two
+  }
+  pushblock(i, k);
+}
+
+// Allocate a block of order k, splitting a larger one if need
+// be. Returns its first page number, or -1.
+// Caller must hold kmem.lock.
+static int
+getblock(int k)
+{
+  int i, j;
+
+  for(j = k; j <= MAXORDER && kmem.free[j] == 0; j++)
+    ;
+  if(j > MAXORDER)
+    return -1;
+  i = pgnum(kmem.free[j]);
+  pullblock(i, j);
+  // Keep the upper halves.
+  while(j > k){
+    j--;
+    pushblock(i + (1 << j), j);
+  }
+  return i;
+}
+
+// Give the zeroed pages back to the buddy lists, so that they
+// can merge. Returns the number of pages.
+static int
+drainzeroed(void)
+{
+  struct run *r;
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.nzeroed;
+  while((r = kmem.zeroed) != 0){
+    kmem.zeroed = r->next;
+    freeblock(pgnum(r), 0);
+  }
+  kmem.nzeroed = 0;
+  release(&kmem.lock);
+  return n;
+}
+
+// Free memory is carved into the largest aligned blocks that
+// fit, which touches only the first page of each.
 void
 kinit()
 {
+  int i, k;
+
   initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  for(i = pgnum((void*)PGROUNDUP((uint64)end)); i < NPAGE; i += 1 << k){
+    for(k = MAXORDER; k > 0; k--)
+      if(i % (1 << k) == 0 && i + (1 << k) <= NPAGE)
+        break;
+    pushblock(i, k);
+    kmem.nfree += 1 << k;
+  }
 }
 
+// Free the block of 2^order pages of physical memory pointed
+// at by pa, which normally should have been returned by a call
+// to kalloc_order(order).
 void
-freerange(void *pa_start, void *pa_end)
+kfree_order(void *pa, int order)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa + (PGSIZE << order) > PHYSTOP)
+    panic("kfree");
+
+#ifdef KJUNK
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  freeblock(pgnum(pa), order);
+  kmem.nfree += 1 << order;
+  release(&kmem.lock);
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().
 void
 kfree(void *pa)
 {
-  struct run *r;
+  kfree_order(pa, 0);
+}
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
-    panic("kfree");
+// The order of the smallest block that holds n bytes.
+int
+korder(uint64 n)
+{
+  int k;
 
-  // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  for(k = 0; k < MAXORDER && ((uint64)PGSIZE << k) < n; k++)
+    ;
+  return k;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if the memory cannot be allocated,
+// even after shrinking the buffer cache.
+void *
+kalloc_order(int order)
+{
+  int i;
 
-  r = (struct run*)pa;
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  for(;;){
+    acquire(&kmem.lock);
+    if((i = getblock(order)) >= 0)
+      kmem.nfree -= 1 << order;
+    release(&kmem.lock);
+    if(i >= 0)
+      break;
+    if(drainzeroed() == 0 && bshrink() == 0)
+      return 0;
+  }
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+#ifdef KJUNK
+  memset((char*)pgaddr(i), 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)pgaddr(i);
+}
+
+// Take a free page, preferring the zeroed list if wantzero
+// is set and the buddy lists otherwise. Sets *zeroed to
+// whether the page came back zero-filled.
+static struct run*
+kget(int wantzero, int *zeroed)
+{
+  struct run *r;
+  int i;
+
+  for(;;){
+    acquire(&kmem.lock);
+    r = 0;
+    *zeroed = 0;
+    if(!wantzero && (i = getblock(0)) >= 0){
+      r = pgaddr(i);
+    } else if(kmem.zeroed){
+      r = kmem.zeroed;
+      kmem.zeroed = r->next;
+      kmem.nzeroed--;
+      *zeroed = 1;
+    } else if(wantzero && (i = getblock(0)) >= 0){
+      r = pgaddr(i);
+    }
+    if(r)
+      kmem.nfree--;
+    release(&kmem.lock);
+    if(r || bshrink() == 0)
+      break;
+  }
+
+  // The list link is the one word of a zeroed page that isn't.
+  if(r && *zeroed)
+    r->next = 0;
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Returns 0 if the memory cannot be allocated,
+// even after shrinking the buffer cache.
 void *
 kalloc(void)
 {
   struct run *r;
+  int zeroed;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
-
+  r = kget(0, &zeroed);
+#ifdef KJUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Allocate one zero-filled page, preferably one that
+// the idle loop has already zeroed.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+  int zeroed;
+
+  r = kget(1, &zeroed);
+  if(r && !zeroed)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Called by an idle CPU's scheduler loop: zero a free page and
+// move it to the zeroed list, so that a later kalloc_zeroed()
+// needn't. Returns 0 if there was nothing to do.
+int
+kzeroidle(void)
+{
+  struct run *r;
+  int i;
+
+  // don't contend for the lock once the list is full.
+  if(kmem.nzeroed >= NZEROED)
+    return 0;
+  acquire(&kmem.lock);
+  if((i = getblock(0)) >= 0)
+    kmem.nfree--;
+  release(&kmem.lock);
+  if(i < 0)
+    return 0;
+
+  r = pgaddr(i);
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zeroed;
+  kmem.zeroed = r;
+  kmem.nzeroed++;
+  kmem.nfree++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Number of free pages.
+int
+kfreecount(void)
+{
+  return kmem.nfree;
+}
+
+void
+kstat(struct kmemstat *st)
+{
+  int k;
+
+  acquire(&kmem.lock);
+  st->nfree = kmem.nfree;
+  st->nzeroed = kmem.nzeroed;
+  for(k = 0; k <= MAXORDER; k++)
+    st->nblock[k] = kmem.nblock[k];
+  release(&kmem.lock);
+}
@@ -4,6 +4,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -16,131 +17,270 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves log space for the
+// MAXOPBLOCKS blocks a typical FS system call might write;
+// begin_opn(n) reserves space for n, for operations that
+// know how much they will write. Usually begin_op() just adds
+// the reservation and returns. But if the log is too full
+// to hold it, it sleeps until outstanding operations end
+// and commit.
+//
+// If the kernel is built with ASYNCCOMMIT, end_op() does not
+// commit: the transaction stays open, absorbing the updates of
+// later system calls, until the flusher thread commits it, the
+// log fills, or fsync() calls log_force(). A crash loses the
+// operations since the last commit, but never part of one.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// mkfs chooses its size and records it in the superblock.
+// The on-disk log format (see fs.h):
+//   header block, containing the sequence number of the
+//     first transaction in the log
+//   descriptor block, containing a transaction's sequence
+//     number, a checksum, and block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+//   descriptor block for the next transaction, ...
+// A large transaction may need several descriptors; the
+// last one is marked LD_COMMIT. A commit writes a transaction's
+// blocks and descriptors as one batch, in any order, without
+// waiting for one write to finish before starting the next.
+// Recovery replays transactions, in sequence, only as long as
+// their checksums match and they end with a commit descriptor;
+// a transaction torn by a crash is discarded.
+//
+// Committing a transaction appends it to the log; its blocks
+// are not installed at their home locations yet. They stay
+// pinned, dirty, in the buffer cache, and the log accumulates
+// successive transactions (a block written by several
+// transactions appears once per transaction, the latest last).
+// A checkpoint installs them all, once each and sorted by block
+// number, and then empties the log by advancing the header's
+// sequence number. It happens when an operation needs more space
+// than the log has left, or earlier in the background by the
+// flusher thread. A checkpoint runs only between transactions,
+// so the cached blocks it writes hold exactly the committed data.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
-struct logheader {
-  int n;
-  int block[LOGSIZE];
-};
+// Log blocks that committing k blocks takes: them and their descriptors.
+#define LOGNEED(k) ((k) + ((k) + LOGDPB - 1) / LOGDPB)
+
+#define LOGBATCH 32  // most writes that commit() or checkpoint() issue at once
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // blocks the log can hold, descriptors included.
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // blocks they have reserved.
+  int committing;  // in commit() or checkpoint(), please wait.
+  int forcing;     // log_force() callers waiting to commit.
+  int async;       // leave commits to the flusher and log_force().
   int dev;
-  struct logheader lh;
+  uint seq;        // sequence number of the next transaction.
+  int used;        // log blocks taken by committed transactions.
+  int committed;   // block[0..committed) are committed to the log.
+  int n;           // blocks logged, committed or not.
+  int block[LOGSIZE]; // their home block numbers.
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void checkpoint(void);
+static void flusher(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
-
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.cap = log.size - 1;
+  if(log.cap > LOGSIZE)
+    log.cap = LOGSIZE;
+  if(log.cap < LOGNEED(MAXOPBLOCKS))
+    panic("initlog: log too small");
   log.dev = dev;
+#ifdef ASYNCCOMMIT
+  log.async = 1;
+#endif
   recover_from_log();
+  if(kthread(flusher, "flusher") < 0)
+    panic("initlog: flusher");
+}
+
+// Checksum n bytes at p, continuing from sum.
+static uint
+logsum(uint sum, void *p, int n)
+{
+  uint *w = p;
+  int i;
+
+  for (i = 0; i < n / sizeof(uint); i++) {
+    sum ^= w[i];
+    sum *= 16777619;
+  }
+  return sum;
 }
 
-// Copy committed blocks from log to their home location
+// Write the header with log.seq, emptying the log.
 static void
-install_trans(int recovering)
+write_head(void)
+{
+  struct buf *buf = bclaim(log.dev, log.start);
+  memset(buf->data, 0, BSIZE);
+  ((struct loghead *) (buf->data))->seq = log.seq;
+  bwrite(buf);
+  brelse(buf);
+}
+
+// Copy the blocks of a recovered transaction, which are
+// at log blocks slot[0..log.n), to their home locations.
+static void
+install_trans(uint *slot)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+  for (tail = 0; tail < log.n; tail++) {
+    struct buf *lbuf = bread(log.dev, log.start+slot[tail]); // read log block
+    struct buf *dbuf = bread(log.dev, log.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
 }
 
-// Read the log header from disk into the in-memory log header
-static void
-read_head(void)
+// Check the record whose descriptor is at log block pos.
+// Returns its descriptor, locked, if it belongs to
+// transaction seq and its checksum matches, else 0.
+static struct buf*
+read_record(uint pos, uint seq)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
-  }
-  brelse(buf);
-}
+  struct buf *d, *b;
+  struct logdesc *ld;
+  uint sum, want;
+  int k;
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
-static void
-write_head(void)
-{
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  d = bread(log.dev, log.start + pos);
+  ld = (struct logdesc *) d->data;
+  if (ld->magic != LOGMAGIC || ld->seq != seq || ld->n > LOGDPB ||
+      pos + 1 + ld->n > log.size || log.n + ld->n > LOGSIZE) {
+    brelse(d);
+    return 0;
   }
-  bwrite(buf);
-  brelse(buf);
+  want = ld->sum;
+  ld->sum = 0;
+  sum = logsum(2166136261, ld, BSIZE);
+  ld->sum = want;
+  for (k = 0; k < ld->n; k++) {
+    b = bread(log.dev, log.start + pos + 1 + k);
+    sum = logsum(sum, b->data, BSIZE);
+    brelse(b);
+  }
+  if (sum != want) {
+    brelse(d);
+    return 0;
+  }
+  return d;
 }
 
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  static uint slot[LOGSIZE];
+  struct buf *buf;
+  struct logdesc *ld;
+  uint seq, pos;
+  int k, m, done;
+
+  buf = bread(log.dev, log.start);
+  seq = ((struct loghead *) (buf->data))->seq;
+  brelse(buf);
+
+  log.n = 0;
+  for (pos = 1; pos < log.size; pos += 1 + m) {
+    if ((buf = read_record(pos, seq)) == 0)
+      break;
+    ld = (struct logdesc *) buf->data;
+    m = ld->n;
+    for (k = 0; k < m; k++) {
+      log.block[log.n] = ld->block[k];
+      slot[log.n] = pos + 1 + k;
+      log.n++;
+    }
+    done = ld->flags & LD_COMMIT;
+    brelse(buf);
+    if (done) {
+      install_trans(slot); // committed, so copy from log to disk
+      log.n = 0;
+      seq++;
+    }
+  }
+
+  // Any blocks left are from a transaction torn by a crash.
+  // Drop them, and never reuse its sequence number.
+  log.n = 0;
+  log.seq = seq + 1;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call
+// that might write as many as n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log_opmax())
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    if(log.committing || log.forcing){
       sleep(&log, &log.lock);
+    } else if(log.used + LOGNEED(log.n - log.committed + log.reserved + n) > log.cap){
+      if(log.outstanding == 0){
+        // only ended operations stand in the way; commit
+        // them if need be, install, and empty the log.
+        log.committing = 1;
+        release(&log.lock);
+        commit();
+        checkpoint();
+        acquire(&log.lock);
+        log.committing = 0;
+        wakeup(&log);
+      } else {
+        // this op might exhaust log space; wait for commit.
+        sleep(&log, &log.lock);
+      }
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// The most blocks one operation may reserve: half the log,
+// so that two large operations can proceed at once.
+int
+log_opmax(void)
+{
+  if(log.cap / 2 < MAXOPBLOCKS)
+    return MAXOPBLOCKS;
+  return log.cap / 2;
+}
+
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void
@@ -150,15 +290,18 @@ end_op(void)
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
+  if(log.outstanding == 0 && !log.async){
     do_commit = 1;
     log.committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+    // and giving back this op's reservation has
+    // made more room. log_force() and the flusher
+    // may be waiting for no operations to be outstanding.
     wakeup(&log);
   }
   release(&log.lock);
@@ -174,37 +317,192 @@ end_op(void)
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the batch of n locked buffers bufs[i] to log.start +
+// slots[i], and release them.
 static void
-write_log(void)
+write_batch(struct buf **bufs, uint *slots, int n)
 {
-  int tail;
+  int i;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
-  }
+  bwritev(bufs, slots, n);
+  for (i = 0; i < n; i++)
+    brelse(bufs[i]);
 }
 
+// Append the current transaction to the log: for each group
+// of up to LOGDPB blocks, a descriptor and then the blocks,
+// copied straight from the cache. All of it goes to the disk
+// in batches, with no ordering between the writes.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  static struct buf *bufs[LOGBATCH];  // protected by log.committing
+  static uint slots[LOGBATCH];
+  struct buf *d, *b;
+  struct logdesc *ld;
+  uint pos, sum;
+  int i, k, m, nb;
+
+  if (log.n == log.committed)
+    return;
+
+  pos = log.start + 1 + log.used;
+  nb = 0;
+  for (i = log.committed; i < log.n; i += m) {
+    m = log.n - i;
+    if (m > LOGDPB)
+      m = LOGDPB;
+
+    d = bclaim(log.dev, pos);
+    memset(d->data, 0, BSIZE);
+    ld = (struct logdesc *) d->data;
+    ld->magic = LOGMAGIC;
+    ld->seq = log.seq;
+    ld->flags = (i + m == log.n) ? LD_COMMIT : 0;
+    ld->n = m;
+    for (k = 0; k < m; k++)
+      ld->block[k] = log.block[i + k];
+    sum = logsum(2166136261, ld, BSIZE);
+
+    for (k = 0; k < m; k++) {
+      b = bread(log.dev, log.block[i + k]); // cache block
+      sum = logsum(sum, b->data, BSIZE);
+      if (nb >= LOGBATCH - 1) {  // keep a place for d
+        write_batch(bufs, slots, nb);
+        nb = 0;
+      }
+      bufs[nb] = b;
+      slots[nb++] = pos + 1 + k;
+    }
+
+    ld->sum = sum;
+    bufs[nb] = d;
+    slots[nb++] = pos;
+    pos += 1 + m;
+  }
+  write_batch(bufs, slots, nb); // the real commit
+
+  log.used = pos - (log.start + 1);
+  log.committed = log.n;
+  log.seq++;
+}
+
+// Write every committed block from the cache to its home
+// location, each block once and in increasing block order,
+// then empty the log. Caller must have set log.committing.
+static void
+checkpoint(void)
+{
+  static int blocks[LOGSIZE];  // protected by log.committing
+  static struct buf *bufs[LOGBATCH];
+  int i, j, n, nb, b;
+
+  if (log.n == 0)
+    return;
+  if (log.committed != log.n)
+    panic("checkpoint");
+
+  // Insertion sort, dropping duplicates.
+  n = 0;
+  for (i = 0; i < log.n; i++) {
+    b = log.block[i];
+    for (j = n; j > 0 && blocks[j-1] > b; j--)
+      ;
+    if (j > 0 && blocks[j-1] == b)
+      continue;
+    memmove(&blocks[j+1], &blocks[j], (n-j) * sizeof(int));
+    blocks[j] = b;
+    n++;
+  }
+
+  // Install, a batch at a time.
+  nb = 0;
+  for (i = 0; i < n; i++) {
+    bufs[nb++] = bread(log.dev, blocks[i]); // pinned, so cached
+    if (nb == LOGBATCH || i == n-1) {
+      bwritev(bufs, 0, nb);
+      for (j = 0; j < nb; j++)
+        brelse(bufs[j]);
+      nb = 0;
+    }
+  }
+
+  write_head();    // Erase the transactions from the log
+
+  // Unpin once per log entry, matching log_write().
+  for (i = 0; i < log.n; i++) {
+    struct buf *dbuf = bread(log.dev, log.block[i]);
+    bunpin(dbuf);
+    brelse(dbuf);
+  }
+
+  log.n = 0;
+  log.committed = 0;
+  log.used = 0;
+}
+
+// Commit every operation that has ended, so that their
+// updates will survive a crash. Used by fsync().
+// Must not be called inside an operation.
+void
+log_force(void)
+{
+  acquire(&log.lock);
+  log.forcing++;
+  while(log.committing || log.outstanding > 0)
+    sleep(&log, &log.lock);
+  log.forcing--;
+  log.committing = 1;
+  release(&log.lock);
+
+  commit();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// The flusher thread commits and checkpoints every FLUSHTICKS
+// ticks, so that committed blocks reach their home locations
+// without waiting for the log to fill, and without an FS system
+// call paying for the writes.
+static void
+flusher(void)
+{
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < FLUSHTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    while(log.committing || log.outstanding > 0)
+      sleep(&log, &log.lock);
+    if(log.n == 0){
+      release(&log.lock);
+      continue;
+    }
+    log.committing = 1;
+    release(&log.lock);
+
+    commit();
+    checkpoint();
+
+    acquire(&log.lock);
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit() will do the log write, and checkpoint()
+// the write to the block's home location.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,20 +515,22 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.n >= LOGSIZE ||
+      log.used + LOGNEED(log.n - log.committed + 1) > log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+  // Absorb only within the current transaction: the log
+  // copies of committed transactions must stay intact.
+  for (i = log.committed; i < log.n; i++) {
+    if (log.block[i] == b->blockno)   // log absorption
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  log.block[i] = b->blockno;
+  if (i == log.n) {  // Add new block to log?
     bpin(b);
-    log.lh.n++;
+    log.n++;
   }
   release(&log.lock);
 }
-
@@ -6,29 +6,80 @@
 
 volatile static int started = 0;
 
+// qemu's time CSR counts at 10 MHz.
+#define TIMEFREQ 10000000
+
+// How long each stage of booting took, for bootreport().
+static struct {
+  char *name;
+  uint64 us;
+} stages[24];
+static int nstage;
+static uint64 tstage;
+
+// Note that boot stage name has just finished.
+static void
+bootstage(char *name)
+{
+  uint64 t = r_time();
+
+  if(nstage < NELEM(stages)){
+    stages[nstage].name = name;
+    stages[nstage].us = (t - tstage) / (TIMEFREQ / 1000000);
+    nstage++;
+  }
+  tstage = t;
+}
+
+static void
+bootreport(void)
+{
+  uint64 total;
+  int i;
+
+  total = 0;
+  printf("boot times (us):");
+  for(i = 0; i < nstage; i++){
+    if(i % 6 == 0)
+      printf("\n ");
+    printf(" %s %d", stages[i].name, (int)stages[i].us);
+    total += stages[i].us;
+  }
+  printf("\n  total %d\n", (int)total);
+}
+
+// Run an init function as a boot stage.
+#define STAGE(f) (f(), bootstage(#f))
+
 // start() jumps here in supervisor mode on all CPUs.
 void
 main()
 {
   if(cpuid() == 0){
-    consoleinit();
-    printfinit();
+    bootstage("start");    // firmware and start(), since reset
+    STAGE(consoleinit);
+    STAGE(printfinit);
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
-    kinit();         // physical page allocator
-    kvminit();       // create kernel page table
-    kvminithart();   // turn on paging
-    procinit();      // process table
-    trapinit();      // trap vectors
-    trapinithart();  // install kernel trap vector
-    plicinit();      // set up interrupt controller
-    plicinithart();  // ask PLIC for device interrupts
-    binit();         // buffer cache
-    iinit();         // inode table
-    fileinit();      // file table
-    virtio_disk_init(); // emulated hard disk
-    userinit();      // first user process
+    STAGE(kinit);         // physical page allocator
+    STAGE(kvminit);       // create kernel page table
+    STAGE(kvminithart);   // turn on paging
+    STAGE(procinit);      // process table
+    STAGE(trapinit);      // trap vectors
+    STAGE(trapinithart);  // install kernel trap vector
+    STAGE(plicinit);      // set up interrupt controller
+    STAGE(plicinithart);  // ask PLIC for device interrupts
+    STAGE(binit);         // buffer cache
+    STAGE(iinit);         // inode table
+    STAGE(dcacheinit);    // directory name lookup cache
+    STAGE(fileinit);      // file table
+    STAGE(pipeinit);      // pipe objects
+    STAGE(pollinit);      // poll() wait queues
+    STAGE(ringinit);      // submission/completion rings
+    STAGE(virtio_disk_init); // emulated hard disk
+    STAGE(userinit);      // first user process
+    bootreport();
     __sync_synchronize();
     started = 1;
   } else {
@@ -59,6 +59,8 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   URING (shared rings, if ringsetup() was called)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define URING (TRAPFRAME - PGSIZE)
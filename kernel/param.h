@@ -1,13 +1,17 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // open files per process before its table grows
+#define MAXOFILE   1024  // maximum open files per process
+#define NDCACHE     128  // size of directory name lookup cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      512   // max data blocks in on-disk log
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEFRAC   16    // disk block cache gets 1/BCACHEFRAC of memory
+#define FLUSHTICKS   20    // ticks between background log checkpoints
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define PIPEPAGES    1     // pages in a new pipe's buffer
+#define MAXPIPEPAGES 16    // max pages in a pipe's buffer
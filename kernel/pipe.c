@@ -1,3 +1,25 @@
+// Pipes.
+//
+// A pipe's data lives in a ring of whole pages: PIPEPAGES of
+// them to begin with, and up to MAXPIPEPAGES after
+// fcntl(F_SETPIPE_SZ). The number of pages is a power of two,
+// so byte i of the stream is always at offset i % PGSIZE of
+// page (i / PGSIZE) % npage, even after nread and nwrite wrap.
+// Reads and writes copy the longest run that is contiguous in
+// one page at a time, and do so without holding the pipe's
+// lock, so that a reader and a writer on different CPUs can
+// copy at once; rbusy and wbusy keep other readers and
+// writers out meanwhile. rwant and wwant record whether
+// anyone is asleep, so that a transfer only pays for a
+// wakeup() when it has to.
+//
+// splice() moves data between a pipe and a file through the
+// ring, with no user buffer in between: pipegetspan() lends
+// the caller a run of the ring, marked busy in the same way,
+// and pipeputspan() gives it back. vmsplice() moves whole,
+// aligned pages between user memory and the ring by trading
+// the physical pages, without copying.
+
 #include "types.h"
 #include "riscv.h"
 #include "defs.h"
@@ -7,47 +29,125 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
-
-#define PIPESIZE 512
+#include "fcntl.h"
+#include "poll.h"
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[MAXPIPEPAGES]; // the ring
+  uint npage;     // pages in the ring, a power of two
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a reader is copying out, unlocked
+  int wbusy;      // a writer is copying in, unlocked
+  int rwant;      // a reader sleeps on nread
+  int wwant;      // a writer sleeps on nwrite
+  struct waitq wq; // poll()s waiting on either end
 };
 
+#define PIPECAP(pi) ((pi)->npage * PGSIZE)
+
+static struct kmem_cache *pipecache;
+
+void
+pipeinit(void)
+{
+  pipecache = kmem_cache_create("pipe", sizeof(struct pipe));
+}
+
+// Address of byte i of the stream in pi's ring.
+static char*
+pipeaddr(struct pipe *pi, uint i)
+{
+  return pi->page[(i / PGSIZE) % pi->npage] + i % PGSIZE;
+}
+
+// Length of the run at byte i of the stream that is at most
+// n bytes, at most avail bytes, and within one page.
+static int
+pipespan(uint i, int n, uint avail)
+{
+  uint m = PGSIZE - i % PGSIZE;
+
+  if(m > avail)
+    m = avail;
+  if(m > n)
+    m = n;
+  return m;
+}
+
+// Wake readers, if any are waiting for data.
+// Caller must hold pi->lock.
+static void
+pipewakereaders(struct pipe *pi)
+{
+  if(pi->rwant){
+    pi->rwant = 0;
+    wakeup(&pi->nread);
+  }
+  pollwakeup(&pi->wq);
+}
+
+// Wake writers, if any are waiting for room.
+// Caller must hold pi->lock.
+static void
+pipewakewriters(struct pipe *pi)
+{
+  if(pi->wwant){
+    pi->wwant = 0;
+    wakeup(&pi->nwrite);
+  }
+  pollwakeup(&pi->wq);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
+  int i;
 
   pi = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmem_cache_alloc(pipecache)) == 0)
     goto bad;
+  pi->npage = 0;
+  for(i = 0; i < PIPEPAGES; i++){
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
+    pi->npage++;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->rbusy = 0;
+  pi->wbusy = 0;
+  pi->rwant = 0;
+  pi->wwant = 0;
+  pi->wq.head = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = pi;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = pi;
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
+  if(pi){
+    for(i = 0; i < pi->npage; i++)
+      kfree(pi->page[i]);
+    kmem_cache_free(pipecache, pi);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -58,6 +158,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *pi, int writable)
 {
+  int i;
+
   acquire(&pi->lock);
   if(writable){
     pi->writeopen = 0;
@@ -66,17 +168,127 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup(&pi->wq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    for(i = 0; i < pi->npage; i++)
+      kfree(pi->page[i]);
+    kmem_cache_free(pipecache, pi);
   } else
     release(&pi->lock);
 }
 
+// Return pi's capacity in bytes.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipesize(struct pipe *pi)
+{
+  int n;
+
+  acquire(&pi->lock);
+  n = PIPECAP(pi);
+  release(&pi->lock);
+  return n;
+}
+
+// Resize pi's ring to hold at least n bytes, rounded up to
+// a power of two pages. Fails if that is more than
+// MAXPIPEPAGES, or less than the data now in the pipe.
+// Returns the new capacity in bytes, or -1.
+int
+pipesetsize(struct pipe *pi, int n)
+{
+  char *page[MAXPIPEPAGES], *old[MAXPIPEPAGES];
+  uint i, m, np, nb, nold;
+
+  if(n < 0)
+    return -1;
+  for(np = 1; np < MAXPIPEPAGES && np * PGSIZE < n; np *= 2)
+    ;
+  if(np * PGSIZE < n)
+    return -1;
+
+  // allocate first; kalloc() may have to wait.
+  for(i = 0; i < np; i++){
+    if((page[i] = kalloc()) == 0){
+      while(i > 0)
+        kfree(page[--i]);
+      return -1;
+    }
+  }
+
+  acquire(&pi->lock);
+  while(pi->rbusy || pi->wbusy){
+    if(killed(myproc()))
+      break;
+    if(pi->rbusy){
+      pi->rwant = 1;
+      sleep(&pi->nread, &pi->lock);
+    } else {
+      pi->wwant = 1;
+      sleep(&pi->nwrite, &pi->lock);
+    }
+  }
+  nb = pi->nwrite - pi->nread;
+  if(pi->rbusy || pi->wbusy || nb > np * PGSIZE){
+    release(&pi->lock);
+    for(i = 0; i < np; i++)
+      kfree(page[i]);
+    return -1;
+  }
+  // copy the data to the start of the new ring.
+  for(i = 0; i < nb; i += m){
+    m = pipespan(pi->nread + i, nb - i, PGSIZE - i % PGSIZE);
+    memmove(page[i / PGSIZE] + i % PGSIZE, pipeaddr(pi, pi->nread + i), m);
+  }
+  for(i = 0; i < MAXPIPEPAGES; i++){
+    old[i] = pi->page[i];
+    pi->page[i] = i < np ? page[i] : 0;
+  }
+  nold = pi->npage;
+  pi->npage = np;
+  pi->nwrite = nb;
+  pi->nread = 0;
+  pipewakewriters(pi);
+  release(&pi->lock);
+
+  for(i = 0; i < nold; i++)
+    kfree(old[i]);
+  return np * PGSIZE;
+}
+
+// Trade the current process's user page at va for the ring
+// page pg, so that a page of data moves between user memory
+// and the pipe without being copied. va must be page-aligned
+// and mapped writable by the user, in the process's memory
+// proper: not the ring from ringsetup(), for example.
+// Returns the user's old page, or 0.
+static char*
+pipetrade(uint64 va, char *pg)
+{
+  pte_t *pte;
+  char *old;
+
+  if(va >= myproc()->sz || (pte = walk(myproc()->pagetable, va, 0)) == 0)
+    return 0;
+  if((*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W))
+    return 0;
+  old = (char*)PTE2PA(*pte);
+  *pte = PA2PTE(pg) | PTE_FLAGS(*pte);
+  return old;
+}
+
+// Write n bytes from addr to pi, where addr is a user virtual
+// address if user_src is 1, else a kernel address.
+// If gift is set, whole pages of user memory move into the
+// ring when they can, and the user gets zeroed pages back.
+// If nonblock is set, return what has been written, or
+// -EAGAIN if nothing, rather than wait for room.
+static int
+pipeput(struct pipe *pi, int user_src, uint64 addr, int n, int gift, int nonblock)
 {
-  int i = 0;
+  int i = 0, m, r;
+  uint slot;
+  char *pg, *dst;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,46 +297,221 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPECAP(pi)){ //DOC: pipewrite-full
+      if(nonblock){
+        if(i == 0)
+          i = -EAGAIN;
+        break;
+      }
+      pi->wwant = 1;
       sleep(&pi->nwrite, &pi->lock);
+    } else if(gift && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+              pi->nwrite % PGSIZE == 0 &&
+              pi->nread + PIPECAP(pi) - pi->nwrite >= PGSIZE &&
+              (pg = pipetrade(addr + i, pipeaddr(pi, pi->nwrite))) != 0){
+      // the user's page is now in the ring; its new page
+      // must not show it old pipe data.
+      memset(pipeaddr(pi, pi->nwrite), 0, PGSIZE);
+      slot = (pi->nwrite / PGSIZE) % pi->npage;
+      pi->page[slot] = pg;
+      pi->nwrite += PGSIZE;
+      i += PGSIZE;
+      pipewakereaders(pi);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = pipespan(pi->nwrite, n - i, pi->nread + PIPECAP(pi) - pi->nwrite);
+      dst = pipeaddr(pi, pi->nwrite);
+      pi->wbusy = 1;
+      release(&pi->lock);
+      r = either_copyin(dst, user_src, addr + i, m);
+      acquire(&pi->lock);
+      pi->wbusy = 0;
+      if(r == -1){
+        pipewakewriters(pi);
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      }
+      pi->nwrite += m;
+      i += m;
+      pipewakereaders(pi);
     }
   }
-  wakeup(&pi->nread);
+  // let in a writer that waited while this one was copying.
+  pipewakewriters(pi);
   release(&pi->lock);
 
   return i;
 }
 
-int
-piperead(struct pipe *pi, uint64 addr, int n)
+// Read up to n bytes from pi to user address addr.
+// If gift is set, whole pages move from the ring into
+// user memory when they can. If nonblock is set, return
+// -EAGAIN rather than wait for data.
+static int
+pipeget(struct pipe *pi, uint64 addr, int n, int gift, int nonblock)
 {
-  int i;
+  int i, m, r;
+  uint slot;
+  char *pg, *src;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
+    if(nonblock){
+      release(&pi->lock);
+      return -EAGAIN;
+    }
+    pi->rwant = 1;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+  for(i = 0; i < n && pi->nread != pi->nwrite; ){  //DOC: piperead-copy
+    if(gift && (addr + i) % PGSIZE == 0 && n - i >= PGSIZE &&
+       pi->nread % PGSIZE == 0 && pi->nwrite - pi->nread >= PGSIZE &&
+       (pg = pipetrade(addr + i, pipeaddr(pi, pi->nread))) != 0){
+      slot = (pi->nread / PGSIZE) % pi->npage;
+      pi->page[slot] = pg;
+      m = PGSIZE;
+    } else {
+      m = pipespan(pi->nread, n - i, pi->nwrite - pi->nread);
+      src = pipeaddr(pi, pi->nread);
+      pi->rbusy = 1;
+      release(&pi->lock);
+      r = copyout(pr->pagetable, addr + i, src, m);
+      acquire(&pi->lock);
+      pi->rbusy = 0;
+      if(r == -1)
+        break;
+    }
+    pi->nread += m;
+    i += m;
+    pipewakewriters(pi);  //DOC: piperead-wakeup
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  // let in a reader that waited while this one was copying.
+  pipewakereaders(pi);
   release(&pi->lock);
   return i;
 }
+
+int
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n, int nonblock)
+{
+  return pipeput(pi, user_src, addr, n, 0, nonblock);
+}
+
+int
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
+{
+  return pipeget(pi, addr, n, 0, nonblock);
+}
+
+// Move n bytes between pi and user memory at addr, into the
+// pipe if write is set, else out of it, trading whole
+// page-aligned pages rather than copying them. nonblock is
+// as for pipewrite() and piperead().
+int
+pipevmsplice(struct pipe *pi, int write, uint64 addr, int n, int nonblock)
+{
+  if(write)
+    return pipeput(pi, 1, addr, n, 1, nonblock);
+  return pipeget(pi, addr, n, 1, nonblock);
+}
+
+// Lend the caller the next run of pi's ring, of at most n
+// bytes: data to read if write is 0, free space to fill if
+// write is 1. If nonblock is set, return -EAGAIN rather
+// than wait for data or room.
+// Sets *pp to the run, and marks that end of pi busy until
+// pipeputspan(). Returns the run's length, 0 at end of file,
+// or -1.
+int
+pipegetspan(struct pipe *pi, int write, char **pp, int n, int nonblock)
+{
+  int m;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  if(write){
+    while(pi->wbusy || pi->nwrite == pi->nread + PIPECAP(pi)){
+      if(pi->readopen == 0 || killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(nonblock){
+        release(&pi->lock);
+        return -EAGAIN;
+      }
+      pi->wwant = 1;
+      sleep(&pi->nwrite, &pi->lock);
+    }
+    if(pi->readopen == 0 || killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    m = pipespan(pi->nwrite, n, pi->nread + PIPECAP(pi) - pi->nwrite);
+    *pp = pipeaddr(pi, pi->nwrite);
+    pi->wbusy = 1;
+  } else {
+    while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){
+      if(killed(pr)){
+        release(&pi->lock);
+        return -1;
+      }
+      if(nonblock){
+        release(&pi->lock);
+        return -EAGAIN;
+      }
+      pi->rwant = 1;
+      sleep(&pi->nread, &pi->lock);
+    }
+    m = pipespan(pi->nread, n, pi->nwrite - pi->nread);
+    *pp = pipeaddr(pi, pi->nread);
+    if(m > 0)
+      pi->rbusy = 1;
+  }
+  release(&pi->lock);
+  return m;
+}
+
+// Give back the span from pipegetspan(), of which the
+// caller used the first m bytes.
+void
+pipeputspan(struct pipe *pi, int write, int m)
+{
+  acquire(&pi->lock);
+  if(write){
+    pi->nwrite += m;
+    pi->wbusy = 0;
+  } else {
+    pi->nread += m;
+    pi->rbusy = 0;
+  }
+  pipewakereaders(pi);
+  pipewakewriters(pi);
+  release(&pi->lock);
+}
+
+// poll() of the read end of pi, or of the write end
+// if writable is set.
+int
+pipepoll(struct pipe *pi, int writable, struct poller *pl)
+{
+  int ev = 0;
+
+  pollwait(pl, &pi->wq);
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      ev |= POLLERR;
+    else if(!pi->wbusy && pi->nwrite != pi->nread + PIPECAP(pi))
+      ev |= POLLOUT;
+  } else {
+    if(pi->nwrite != pi->nread && !pi->rbusy)
+      ev |= POLLIN;
+    if(pi->writeopen == 0)
+      ev |= POLLHUP;
+  }
+  release(&pi->lock);
+  return ev;
+}
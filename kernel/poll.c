@@ -0,0 +1,178 @@
+// poll(): wait for any of several files to become ready.
+//
+// Each object that can make a poll() wait (a pipe, the
+// console) has a wait queue. poll() puts a waiter on the
+// queue of every object it looks at, and the object's
+// pollwakeup() wakes just the poll()s on its queue, rather
+// than every sleeper in the system. A poll() with a timeout
+// also waits on polltickq, which the clock wakes each tick.
+//
+// poll.lock protects every queue and the woken flags; it is
+// taken after the objects' own locks.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "poll.h"
+
+// One poll() waiting on one queue.
+struct waiter {
+  struct poller *pl;
+  struct waiter *next;
+};
+
+// The state of one poll() call. It can wait on a queue for
+// each pollfd and polltickq: in q0 and w0 for a small poll(),
+// otherwise in a block from kalloc_order().
+struct poller {
+  int woken;                    // an object changed
+  int nw;
+  int maxw;
+  struct waitq **q;             // queues it is waiting on
+  struct waiter *w;
+  struct waitq *q0[NOFILE+1];
+  struct waiter w0[NOFILE+1];
+};
+
+struct {
+  struct spinlock lock;
+} poll;
+
+struct waitq polltickq;
+
+void
+pollinit(void)
+{
+  initlock(&poll.lock, "poll");
+}
+
+// Add poll() pl, if any, to the waiters on q.
+void
+pollwait(struct poller *pl, struct waitq *q)
+{
+  struct waiter *w;
+
+  if(pl == 0 || pl->nw == pl->maxw)
+    return;
+  acquire(&poll.lock);
+  w = &pl->w[pl->nw];
+  pl->q[pl->nw++] = q;
+  w->pl = pl;
+  w->next = q->head;
+  q->head = w;
+  release(&poll.lock);
+}
+
+// Wake the poll()s waiting on q.
+void
+pollwakeup(struct waitq *q)
+{
+  struct waiter *w;
+
+  if(q->head == 0)
+    return;
+  acquire(&poll.lock);
+  for(w = q->head; w; w = w->next){
+    w->pl->woken = 1;
+    wakeup(w->pl);
+  }
+  release(&poll.lock);
+}
+
+// Called by the clock interrupt each tick.
+void
+polltick(void)
+{
+  pollwakeup(&polltickq);
+}
+
+// Take pl off all the queues it is waiting on.
+static void
+pollfinish(struct poller *pl)
+{
+  struct waiter **pp;
+  int i;
+
+  acquire(&poll.lock);
+  for(i = 0; i < pl->nw; i++){
+    for(pp = &pl->q[i]->head; *pp; pp = &(*pp)->next){
+      if(*pp == &pl->w[i]){
+        *pp = pl->w[i].next;
+        break;
+      }
+    }
+  }
+  release(&poll.lock);
+  pl->nw = 0;
+}
+
+// Fill in the revents of the n pollfds in fds, waiting up
+// to timeout ticks (forever if timeout is negative) for at
+// least one of them to be ready.
+// Returns the number of ready pollfds, or -1 if killed.
+int
+dopoll(struct pollfd *fds, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct poller pl;
+  struct file *f;
+  int i, k, ready, ev, first;
+  uint t0;
+
+  pl.nw = 0;
+  pl.maxw = n + 1;
+  k = -1;
+  if(pl.maxw <= NELEM(pl.w0)){
+    pl.q = pl.q0;
+    pl.w = pl.w0;
+  } else {
+    k = korder(pl.maxw * (sizeof(*pl.q) + sizeof(*pl.w)));
+    if((pl.w = kalloc_order(k)) == 0)
+      return -1;
+    pl.q = (struct waitq**)(pl.w + pl.maxw);
+  }
+  first = 1;
+  t0 = ticks;
+  if(timeout > 0)
+    pollwait(&pl, &polltickq);
+  for(;;){
+    pl.woken = 0;
+    ready = 0;
+    for(i = 0; i < n; i++){
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;
+      if((f = fdget(p, fds[i].fd)) == 0){
+        fds[i].revents = POLLNVAL;
+      } else {
+        // join the object's queue only the first time round.
+        ev = filepoll(f, first ? &pl : 0);
+        fds[i].revents = ev & (fds[i].events | POLLHUP | POLLERR);
+      }
+      if(fds[i].revents)
+        ready++;
+    }
+    first = 0;
+    if(ready || timeout == 0 || (timeout > 0 && ticks - t0 >= timeout))
+      break;
+    if(killed(p)){
+      ready = -1;
+      break;
+    }
+    acquire(&poll.lock);
+    if(!pl.woken)
+      sleep(&pl, &poll.lock);
+    release(&poll.lock);
+  }
+  pollfinish(&pl);
+  if(k >= 0)
+    kfree_order(pl.w, k);
+  return ready;
+}
@@ -0,0 +1,6 @@
+// A wait queue: the poll() calls waiting for an event on
+// one object, such as a pipe or the console. The object
+// calls pollwakeup() on its queue when its state changes.
+struct waitq {
+  struct waiter *head;
+};
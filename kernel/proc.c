@@ -17,6 +17,7 @@ struct spinlock pid_lock;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void kthreadret(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -53,6 +54,9 @@ procinit(void)
   initlock(&wait_lock, "wait_lock");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->fdlock, "fdtable");
+      p->ofile = p->ofile0;
+      p->nofile = NOFILE;
       p->state = UNUSED;
       p->kstack = KSTACK((int) (p - proc));
   }
@@ -168,6 +172,8 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
+  p->ring = 0;
   p->state = UNUSED;
 }
 
@@ -268,6 +274,7 @@ growproc(int n)
       return -1;
     }
   } else if(n < 0){
+    ringcancel(p, sz + n, sz);
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
   p->sz = sz;
@@ -279,7 +286,7 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
@@ -303,9 +310,11 @@ fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+  if(fdcopy(np, p) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
@@ -325,6 +334,26 @@ fork(void)
   return pid;
 }
 
+// Start a kernel thread running fn(), which must never return.
+// A kernel thread is a process with no user memory that is never
+// killed or waited for. Returns 0, or -1 if there is no free proc.
+int
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return -1;
+
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  p->state = RUNNABLE;
+  release(&p->lock);
+  return 0;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -351,14 +380,11 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Finish with ring requests, which may use p's files.
+  ringexit(p);
+
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  fdcloseall(p);
 
   begin_op();
   iput(p->cwd);
@@ -446,6 +472,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int found;
 
   c->proc = 0;
   for(;;){
@@ -454,9 +481,11 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
+    found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
       if(p->state == RUNNABLE) {
+        found = 1;
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
@@ -470,6 +499,11 @@ scheduler(void)
       }
       release(&p->lock);
     }
+
+    // Nothing to run: spend the time zeroing a free page,
+    // for kalloc_zeroed().
+    if(!found)
+      kzeroidle();
   }
 }
 
@@ -535,6 +569,18 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
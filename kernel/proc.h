@@ -101,7 +101,20 @@ struct proc {
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+
+  // fdlock must be held when using these (see file.c):
+  struct spinlock fdlock;
+  struct file **ofile;         // Open files, nofile slots
+  int nofile;
+  uint64 fdmap[MAXOFILE/64];   // Bit fd set if ofile[fd] is in use
+  struct file *ofile0[NOFILE]; // ofile until it grows
+
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  int logres;                  // Log blocks reserved by begin_opn()
+  void (*kfn)(void);           // Body of a kernel thread, else 0
+  struct uring *ring;          // Shared rings from ringsetup(), or 0
+  uint ringsq;                 // Next submission to take from ring
+  uint ringcq;                 // Next completion to fill in ring
+  int ringbusy;                // Ring requests in flight
 };
@@ -0,0 +1,223 @@
+// Object caches for small kernel objects: pipes, open files,
+// and in-memory inodes.
+//
+// A cache hands out objects of one size. It carves them from
+// slabs, blocks of 2^order pages from kalloc_order(), each
+// starting with a struct slab. Since buddy blocks are aligned
+// to their size, an object's slab is found by masking its
+// address. Objects are handed out from the end of a new slab
+// down, so making a slab costs the same whatever the size.
+//
+// In front of the slabs, each CPU has a magazine: a small stack
+// of free objects that it allocates from and frees to with
+// interrupts off and no lock. Only when its magazine is empty
+// (or full) does a CPU take the cache's lock, to move half a
+// magazine's worth of objects from (or to) the slabs.
+//
+// A slab whose objects are all free goes back to kalloc,
+// unless it is the cache's only slab with free objects.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "stat.h"
+
+#define NKCACHE 8     // caches in the system
+#define MAGSIZE 16    // objects in a full magazine
+#define MINOBJ  8     // fewest objects a slab should hold
+
+struct object {
+  struct object *next;  // while free in a slab
+};
+
+struct slab {
+  struct object *free;  // freed objects
+  struct slab *next;    // on the cache's partial list
+  struct slab *prev;
+  int nfree;            // free objects, counting nnew
+  int nnew;             // objects never yet handed out
+};
+
+// sizeof(struct slab), rounded up.
+#define SLABHDR 64
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;              // bytes per object
+  int order;              // slabs are 2^order pages
+  int nobj;               // objects per slab
+  struct slab *partial;   // slabs with free objects
+  struct magazine mag[NCPU];
+};
+
+static struct kmem_cache caches[NKCACHE];
+static int ncache;
+
+// Make a cache of objects of size bytes. Called during boot,
+// by the subsystems that own each kind of object.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+  int k;
+
+  if(ncache == NKCACHE)
+    panic("kmem_cache_create: no caches");
+  size = (size + sizeof(uint64) - 1) & ~(sizeof(uint64) - 1);
+  for(k = 0; k < MAXORDER; k++)
+    if(((PGSIZE << k) - SLABHDR) / size >= MINOBJ)
+      break;
+  if(((PGSIZE << k) - SLABHDR) / size == 0)
+    panic("kmem_cache_create: too big");
+
+  c = &caches[ncache++];
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->order = k;
+  c->nobj = ((PGSIZE << k) - SLABHDR) / size;
+  return c;
+}
+
+static struct slab*
+slabof(struct kmem_cache *c, void *obj)
+{
+  return (struct slab*)((uint64)obj & ~((uint64)(PGSIZE << c->order) - 1));
+}
+
+static void
+push(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+unlink1(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Take a free object from the first partial slab.
+// Caller must hold c->lock, and c->partial must not be empty.
+static void*
+getobj(struct kmem_cache *c)
+{
+  struct slab *s = c->partial;
+  struct object *o;
+
+  if(s->nnew > 0){
+    s->nnew--;
+    o = (struct object*)((char*)s + SLABHDR + s->nnew * c->size);
+  } else {
+    o = s->free;
+    s->free = o->next;
+  }
+  if(--s->nfree == 0)
+    unlink1(c, s);
+  return o;
+}
+
+// Return obj to its slab. Returns the slab if it is now
+// empty and should go back to kalloc, or 0.
+// Caller must hold c->lock.
+static struct slab*
+putobj(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = slabof(c, obj);
+  struct object *o = obj;
+
+  o->next = s->free;
+  s->free = o;
+  if(s->nfree++ == 0)
+    push(c, s);
+  if(s->nfree == c->nobj && (s->prev || s->next)){
+    unlink1(c, s);
+    return s;
+  }
+  return 0;
+}
+
+// Allocate an object from cache c.
+// Returns 0 if memory is exhausted.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  struct slab *s;
+  void *obj;
+
+  for(;;){
+    push_off();
+    m = &c->mag[cpuid()];
+    if(m->n == 0){
+      acquire(&c->lock);
+      while(m->n < MAGSIZE/2 && c->partial)
+        m->obj[m->n++] = getobj(c);
+      release(&c->lock);
+    }
+    if(m->n > 0){
+      obj = m->obj[--m->n];
+      pop_off();
+      return obj;
+    }
+    pop_off();
+
+    // No free objects anywhere: make a slab. kalloc_order()
+    // may shrink the buffer cache, so hold no locks.
+    if((s = kalloc_order(c->order)) == 0)
+      return 0;
+    s->free = 0;
+    s->nfree = c->nobj;
+    s->nnew = c->nobj;
+    acquire(&c->lock);
+    push(c, s);
+    release(&c->lock);
+  }
+}
+
+// Free obj, which came from kmem_cache_alloc(c).
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+  struct slab *s, *empty;
+
+  empty = 0;
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2){
+      if((s = putobj(c, m->obj[--m->n])) != 0){
+        s->next = empty;
+        empty = s;
+      }
+    }
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+
+  while((s = empty) != 0){
+    empty = s->next;
+    kfree_order(s, c->order);
+  }
+}
@@ -9,3 +9,35 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// getdents() flags.
+#define GD_STAT   0x1  // fill struct direntstat records
+
+// A directory entry and its inode's metadata, as filled in by
+// getdents(fd, buf, n, GD_STAT). inum and name are laid out as
+// in struct dirent.
+struct direntstat {
+  ushort inum;
+  char name[14];
+  struct stat st;
+};
+
+// Buffer cache counters, as filled in by bcachestat().
+struct bcachestat {
+  uint64 hits;       // lookups that found the block cached
+  uint64 misses;     // lookups that had to recycle a buffer
+  uint64 evictions;  // recycled buffers that held a block
+  uint64 ghosthits;  // misses on recently recycled "in" blocks
+  int nbuf;          // buffers in the cache
+  int nin;           // of which in the "in" queue
+};
+
+// Largest block kalloc_order() can allocate: 2^MAXORDER pages.
+#define MAXORDER 10
+
+// Physical memory allocator counters, as filled in by kmemstat().
+struct kmemstat {
+  int nfree;                  // free pages
+  int nzeroed;                // of which already zeroed
+  int nblock[MAXORDER+1];     // free blocks of each order
+};
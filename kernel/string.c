@@ -1,13 +1,107 @@
 #include "types.h"
+#ifdef RVV
+#include "riscv.h"
+#include "defs.h"
+#endif
+
+// memset(), memmove(), memcmp() and strlen() work a 64-bit word
+// at a time where alignment allows, and a byte at a time on the
+// ragged ends.
+
+// A uint64 that may alias any other type.
+typedef uint64 __attribute__((may_alias)) word;
+
+#define WSIZE sizeof(word)
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+#ifdef RVV
+// With RVV=1, long memset()s and memmove()s use the vector
+// extension. Nothing saves the vector registers across traps or
+// context switches, so the vector unit is turned on only while
+// they're in use, with interrupts off. It is off the rest of the
+// time, so vector instructions in user programs trap.
+
+#define VMIN 256
+
+static void
+vset(char *d, int c, uint n)
+{
+  uint64 len = n;
+
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INIT);
+  asm volatile(
+    ".option push\n"
+    ".option arch, +v\n"
+    "vsetvli t0, zero, e8, m8, ta, ma\n"
+    "vmv.v.x v0, %2\n"
+    "1:\n"
+    "vsetvli t0, %1, e8, m8, ta, ma\n"
+    "vse8.v v0, (%0)\n"
+    "add %0, %0, t0\n"
+    "sub %1, %1, t0\n"
+    "bnez %1, 1b\n"
+    ".option pop\n"
+    : "+r" (d), "+r" (len) : "r" (c) : "t0", "memory");
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
+
+// Copy forwards, so d may overlap s only if it is below s.
+static void
+vcopy(char *d, const char *s, uint n)
+{
+  uint64 len = n;
+
+  push_off();
+  w_sstatus(r_sstatus() | SSTATUS_VS_INIT);
+  asm volatile(
+    ".option push\n"
+    ".option arch, +v\n"
+    "1:\n"
+    "vsetvli t0, %2, e8, m8, ta, ma\n"
+    "vle8.v v0, (%1)\n"
+    "vse8.v v0, (%0)\n"
+    "add %0, %0, t0\n"
+    "add %1, %1, t0\n"
+    "sub %2, %2, t0\n"
+    "bnez %2, 1b\n"
+    ".option pop\n"
+    : "+r" (d), "+r" (s), "+r" (len) : : "t0", "memory");
+  w_sstatus(r_sstatus() & ~SSTATUS_VS);
+  pop_off();
+}
+#endif
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  char *d = (char *) dst;
+  word *wd;
+  uint64 w;
+
+#ifdef RVV
+  if(n >= VMIN){
+    vset(d, c, n);
+    return dst;
   }
+#endif
+  if(n >= 2*WSIZE){
+    for(; (uint64)d % WSIZE; n--)
+      *d++ = c;
+    w = (uchar)c * ONES;
+    wd = (word*)d;
+    for(; n >= 8*WSIZE; n -= 8*WSIZE, wd += 8){
+      wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+      wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (char*)wd;
+  }
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -18,6 +112,14 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(n >= WSIZE && (uint64)s1 % WSIZE == (uint64)s2 % WSIZE){
+    for(; (uint64)s1 % WSIZE; n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // Skip equal words; the bytes below find the difference.
+    for(; n >= WSIZE && *(word*)s1 == *(word*)s2; n -= WSIZE)
+      s1 += WSIZE, s2 += WSIZE;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -27,6 +129,54 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
+// Copy n bytes forwards from s to d, which may overlap s only
+// if it is below s.
+static void
+copyfwd(char *d, const char *s, uint n)
+{
+  word *wd;
+  const word *ws;
+  uint64 a, b;
+  int sh;
+
+#ifdef RVV
+  if(n >= VMIN){
+    vcopy(d, s, n);
+    return;
+  }
+#endif
+  if(n >= 4*WSIZE){
+    for(; (uint64)d % WSIZE; n--)
+      *d++ = *s++;
+    wd = (word*)d;
+    if((uint64)s % WSIZE == 0){
+      ws = (const word*)s;
+      for(; n >= 8*WSIZE; n -= 8*WSIZE, wd += 8, ws += 8){
+        wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+        wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+      }
+      for(; n >= WSIZE; n -= WSIZE)
+        *wd++ = *ws++;
+    } else {
+      // s is not aligned: build each word of d from the two
+      // aligned words of s it straddles, never reading an
+      // aligned word that holds no byte of s.
+      sh = ((uint64)s % WSIZE) * 8;
+      ws = (const word*)(s - (uint64)s % WSIZE);
+      a = *ws++;
+      for(; n >= WSIZE; n -= WSIZE){
+        b = *ws++;
+        *wd++ = (a >> sh) | (b << (64 - sh));
+        a = b;
+      }
+    }
+    s += (char*)wd - d;
+    d = (char*)wd;
+  }
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
 void*
 memmove(void *dst, const void *src, uint n)
 {
@@ -41,11 +191,19 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(n >= 2*WSIZE && (uint64)s % WSIZE == (uint64)d % WSIZE){
+      for(; (uint64)d % WSIZE; n--)
+        *--d = *--s;
+      for(; n >= WSIZE; n -= WSIZE){
+        d -= WSIZE;
+        s -= WSIZE;
+        *(word*)d = *(const word*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
   } else
-    while(n-- > 0)
-      *d++ = *s++;
+    copyfwd(d, s, n);
 
   return dst;
 }
@@ -98,10 +256,20 @@ safestrcpy(char *s, const char *t, int n)
 int
 strlen(const char *s)
 {
-  int n;
+  const char *p;
+  const word *w;
 
-  for(n = 0; s[n]; n++)
+  for(p = s; (uint64)p % WSIZE; p++)
+    if(*p == 0)
+      return p - s;
+  // A word holds a zero byte if subtracting one from each byte
+  // borrows into the high bit of a byte whose high bit was clear.
+  // Reading the rest of the last word is safe: it can't cross
+  // into another page.
+  for(w = (const word*)p; ((*w - ONES) & ~*w & HIGHS) == 0; w++)
+    ;
+  for(p = (const char*)w; *p; p++)
     ;
-  return n;
+  return p - s;
 }
 
@@ -101,6 +101,22 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_getdents(void);
+extern uint64 sys_bcachestat(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_fdatasync(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_sendfile(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_vmsplice(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_ringsetup(void);
+extern uint64 sys_ringenter(void);
+extern uint64 sys_kmemstat(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -126,6 +142,22 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_getdents] sys_getdents,
+[SYS_bcachestat] sys_bcachestat,
+[SYS_fsync]   sys_fsync,
+[SYS_fdatasync] sys_fdatasync,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_sendfile] sys_sendfile,
+[SYS_splice]  sys_splice,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_fcntl]   sys_fcntl,
+[SYS_poll]    sys_poll,
+[SYS_ringsetup] sys_ringsetup,
+[SYS_ringenter] sys_ringenter,
+[SYS_kmemstat] sys_kmemstat,
 };
 
 void
@@ -20,3 +20,19 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_getdents 22
+#define SYS_bcachestat 23
+#define SYS_fsync  24
+#define SYS_fdatasync 25
+#define SYS_pread  26
+#define SYS_pwrite 27
+#define SYS_readv  28
+#define SYS_writev 29
+#define SYS_sendfile 30
+#define SYS_splice 31
+#define SYS_vmsplice 32
+#define SYS_fcntl  33
+#define SYS_poll   34
+#define SYS_ringsetup 35
+#define SYS_ringenter 36
+#define SYS_kmemstat 37
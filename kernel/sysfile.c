@@ -25,7 +25,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f=fdget(myproc(), fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -39,16 +39,7 @@ argfd(int n, int *pfd, struct file **pf)
 static int
 fdalloc(struct file *f)
 {
-  int fd;
-  struct proc *p = myproc();
-
-  for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
-      return fd;
-    }
-  }
-  return -1;
+  return fdinstall(myproc(), f);
 }
 
 uint64
@@ -94,6 +85,217 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  int n, flags;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &flags);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filegetdents(f, p, n, flags);
+}
+
+// Fetch the pread()/pwrite() arguments as a one-segment
+// I/O vector and an offset, which must not be negative.
+static int
+argpio(struct file **pf, struct iovec *iov, int *off)
+{
+  int n;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, off);
+  if(argfd(0, 0, pf) < 0 || n < 0 || *off < 0)
+    return -1;
+  iov->iov_base = (void*)p;
+  iov->iov_len = n;
+  return 0;
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int off;
+
+  if(argpio(&f, &iov, &off) < 0)
+    return -1;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int off;
+
+  if(argpio(&f, &iov, &off) < 0)
+    return -1;
+  return filewritev(f, &iov, 1, off);
+}
+
+// Fetch the readv()/writev() arguments, copying in the
+// user's I/O vector. The segments must add up to less
+// than 2GB, so the byte count fits in the return value.
+// Returns the number of segments, or -1.
+static int
+argiov(struct file **pf, struct iovec *iov)
+{
+  int i, cnt;
+  uint64 addr, tot;
+
+  argaddr(1, &addr);
+  argint(2, &cnt);
+  if(argfd(0, 0, pf) < 0 || cnt < 0 || cnt > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, cnt*sizeof(struct iovec)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < cnt; i++){
+    if(iov[i].iov_len > 0x7fffffff)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  if(tot > 0x7fffffff)
+    return -1;
+  return cnt;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if((cnt = argiov(&f, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, cnt, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if((cnt = argiov(&f, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, cnt, -1);
+}
+
+// Copy up to n bytes from file in to file out, inside
+// the kernel; in must be a file with an inode.
+uint64
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || n < 0)
+    return -1;
+  return filesend(out, in, n);
+}
+
+// Move up to n bytes between a pipe and a file.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || n < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// Move n bytes between a pipe and user memory.
+uint64
+sys_vmsplice(void)
+{
+  struct file *f;
+  int n;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0 || n < 0)
+    return -1;
+  return filevmsplice(f, p, n);
+}
+
+// Wait for any of n file descriptors to be ready.
+uint64
+sys_poll(void)
+{
+  struct pollfd buf[NOFILE], *fds;
+  uint64 addr;
+  int n, timeout, r, k;
+  struct proc *p = myproc();
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  argint(2, &timeout);
+  if(n < 0 || n > MAXOFILE)
+    return -1;
+  k = -1;
+  fds = buf;
+  if(n > NELEM(buf)){
+    k = korder(n * sizeof(*fds));
+    if((fds = kalloc_order(k)) == 0)
+      return -1;
+  }
+  r = -1;
+  if(copyin(p->pagetable, (char*)fds, addr, n*sizeof(fds[0])) == 0 &&
+     (r = dopoll(fds, n, timeout)) >= 0 &&
+     copyout(p->pagetable, addr, (char*)fds, n*sizeof(fds[0])) < 0)
+    r = -1;
+  if(k >= 0)
+    kfree_order(fds, k);
+  return r;
+}
+
+uint64
+sys_ringsetup(void)
+{
+  return ringsetup();
+}
+
+// Submit up to n ring entries, and wait for minc completions.
+uint64
+sys_ringenter(void)
+{
+  int n, minc;
+
+  argint(0, &n);
+  argint(1, &minc);
+  return ringenter(n, minc);
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  argint(1, &cmd);
+  argint(2, &arg);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filecntl(f, cmd, arg);
+}
+
 uint64
 sys_close(void)
 {
@@ -102,7 +304,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdremove(myproc(), fd);
   fileclose(f);
   return 0;
 }
@@ -119,6 +321,37 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+// The log commits data and metadata together,
+// so there is nothing fsync() could skip.
+uint64
+sys_fdatasync(void)
+{
+  return sys_fsync();
+}
+
+uint64
+sys_bcachestat(void)
+{
+  uint64 addr; // user pointer to struct bcachestat
+  struct bcachestat st;
+
+  argaddr(0, &addr);
+  bstat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -222,6 +455,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -301,18 +535,13 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for open() or a ring worker.
+// Returns the new file, or 0.
+struct file*
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -320,33 +549,31 @@ sys_open(void)
     ip = create(path, T_FILE, 0, 0);
     if(ip == 0){
       end_op();
-      return -1;
+      return 0;
     }
   } else {
     if((ip = namei(path)) == 0){
       end_op();
-      return -1;
+      return 0;
     }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       end_op();
-      return -1;
+      return 0;
     }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
-    return -1;
+    return 0;
   }
 
   if(ip->type == T_DEVICE){
@@ -359,6 +586,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -367,6 +595,25 @@ sys_open(void)
   iunlock(ip);
   end_op();
 
+  return f;
+}
+
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int fd, omode;
+  struct file *f;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if((f = fileopen(path, omode)) == 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -377,7 +624,7 @@ sys_mkdir(void)
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, DIR_HASHED, 0)) == 0){
     end_op();
     return -1;
   }
@@ -488,15 +735,15 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
+      fdremove(p, fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
+    fdremove(p, fd0);
+    fdremove(p, fd1);
     fileclose(rf);
     fileclose(wf);
     return -1;
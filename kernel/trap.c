@@ -167,6 +167,7 @@ clockintr()
   ticks++;
   wakeup(&ticks);
   release(&tickslock);
+  polltick();
 }
 
 // check if it's an external interrupt or software interrupt,
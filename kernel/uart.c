@@ -33,14 +33,16 @@
 #define LCR_BAUD_LATCH (1<<7) // special mode to set baud rate
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
-#define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+#define LSR_TX_IDLE (1<<5)    // THR and the transmit FIFO are empty
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
+#define UART_FIFO_SIZE 16     // bytes the 16550's transmit FIFO holds
+
 // the transmit output buffer.
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 512
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
@@ -77,32 +79,53 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
-// UART to start sending if it isn't already.
+// add n characters from buf to the output buffer and tell
+// the UART to start sending if it isn't already. copies as
+// much as fits at a time, under one acquisition of the lock.
 // blocks if the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
 // by write().
 void
-uartputc(int c)
+uartwrite(char *buf, int n)
 {
+  int i, m;
+
   acquire(&uart_tx_lock);
 
   if(panicked){
     for(;;)
       ;
   }
-  while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
-    // buffer is full.
-    // wait for uartstart() to open up space in the buffer.
-    sleep(&uart_tx_r, &uart_tx_lock);
+  for(i = 0; i < n; ){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+      // buffer is full.
+      // wait for uartstart() to open up space in the buffer.
+      sleep(&uart_tx_r, &uart_tx_lock);
+    }
+    // the free space up to the end of the buffer.
+    m = UART_TX_BUF_SIZE - (uart_tx_w - uart_tx_r);
+    if(m > UART_TX_BUF_SIZE - uart_tx_w % UART_TX_BUF_SIZE)
+      m = UART_TX_BUF_SIZE - uart_tx_w % UART_TX_BUF_SIZE;
+    if(m > n - i)
+      m = n - i;
+    memmove(&uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE], buf + i, m);
+    uart_tx_w += m;
+    i += m;
+    uartstart();
   }
-  uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
-  uart_tx_w += 1;
-  uartstart();
   release(&uart_tx_lock);
 }
 
+// add a character to the output buffer.
+void
+uartputc(int c)
+{
+  char ch = c;
+
+  uartwrite(&ch, 1);
+}
+
 
 // alternate version of uartputc() that doesn't 
 // use interrupts, for use by kernel printf() and
@@ -126,34 +149,36 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, send them: the transmit FIFO
+// is empty when LSR says so, so it takes a burst of up
+// to UART_FIFO_SIZE bytes.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+  int i;
+
+  if(uart_tx_w == uart_tx_r){
+    // transmit buffer is empty.
+    return;
+  }
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART transmit FIFO is not yet empty,
+    // so we cannot count on room for a burst.
+    // it will interrupt when it's ready for more.
+    return;
+  }
+
+  for(i = 0; i < UART_FIFO_SIZE && uart_tx_w != uart_tx_r; i++){
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
     uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
   }
+
+  // maybe uartwrite() is waiting for space in the buffer.
+  wakeup(&uart_tx_r);
 }
 
 // read one input character from the UART.
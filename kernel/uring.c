@@ -0,0 +1,416 @@
+// Asynchronous system calls through shared rings.
+//
+// ringsetup() maps a page holding a struct uring (see uring.h)
+// into the process at URING. ringenter() takes entries off the
+// submission ring, does whatever needs the process's own state
+// (looking up or removing a file descriptor, copying in a path)
+// there and then, and queues the rest for NRINGWORKER kernel
+// threads, which post completions straight into the ring.
+//
+// A worker runs a request as its owner: it borrows the
+// owner's page table, so that fileread() and friends copy to
+// and from the owner's memory, and a reference to the owner's
+// current directory. So the owner must not free its memory
+// while requests are in flight: exit() and exec() cancel them
+// and wait, and growproc() does so for those whose buffers
+// are in the memory it is about to free.
+//
+// ringq.lock protects the request lists and each process's
+// ringcq and ringbusy.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "stat.h"
+#include "uring.h"
+
+#define NRINGWORKER 4
+#define NRINGREQ    64
+
+struct ringreq {
+  struct proc *owner;
+  struct sqe sqe;
+  struct file *f;       // the file, for all but RING_OPEN
+  struct inode *cwd;    // owner's directory, for RING_OPEN
+  char path[MAXPATH];   // for RING_OPEN
+  struct proc *worker;  // running it, or 0
+  struct ringreq *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct ringreq req[NRINGREQ];
+  struct ringreq *free;
+  struct ringreq *head;   // queued, oldest first
+  struct ringreq *tail;
+  int nworker;            // workers created so far
+} ringq;
+
+static void ringworker(void);
+
+void
+ringinit(void)
+{
+  struct ringreq *r;
+
+  initlock(&ringq.lock, "ringq");
+  for(r = ringq.req; r < ringq.req+NRINGREQ; r++){
+    r->next = ringq.free;
+    ringq.free = r;
+  }
+}
+
+// Map a new, empty ring into the current process.
+// Returns its user address, or -1.
+uint64
+ringsetup(void)
+{
+  struct proc *p = myproc();
+  struct uring *u;
+  int n;
+
+  if(p->ring)
+    return -1;
+
+  // start the workers, or those that couldn't be started
+  // last time because the process table was full. kthread()
+  // doesn't sleep, so holding ringq.lock keeps others out.
+  acquire(&ringq.lock);
+  while(ringq.nworker < NRINGWORKER && kthread(ringworker, "ringworker") == 0)
+    ringq.nworker++;
+  n = ringq.nworker;
+  release(&ringq.lock);
+  if(n == 0)
+    return -1;
+
+  if((u = (struct uring*)kalloc_zeroed()) == 0)
+    return -1;
+  if(mappages(p->pagetable, URING, PGSIZE, (uint64)u, PTE_R|PTE_W|PTE_U) < 0){
+    kfree((char*)u);
+    return -1;
+  }
+  p->ring = u;
+  p->ringsq = 0;
+  p->ringcq = 0;
+  p->ringbusy = 0;
+  return URING;
+}
+
+// Post the result of a request with data to p's
+// completion ring. Caller must hold ringq.lock.
+static void
+ringpost(struct proc *p, uint64 data, int res)
+{
+  struct cqe *c;
+
+  c = &p->ring->cq[p->ringcq % RINGSIZE];
+  c->data = data;
+  c->res = res;
+  __sync_synchronize();
+  p->ringcq++;
+  p->ring->cqtail = p->ringcq;
+  wakeup(&p->ring);
+}
+
+// Do the parts of submission e that need the current
+// process, filling in r. Returns 1 if r should go to a
+// worker, else 0 with the result in *res.
+static int
+ringprep(struct ringreq *r, struct sqe *e, int *res)
+{
+  struct proc *p = myproc();
+  struct file *f;
+
+  r->owner = p;
+  r->sqe = *e;
+  r->f = 0;
+  r->cwd = 0;
+  r->worker = 0;
+  *res = -1;
+
+  switch(e->op){
+  case RING_NOP:
+    *res = 0;
+    return 0;
+  case RING_READ:
+  case RING_WRITE:
+  case RING_FSTAT:
+  case RING_CLOSE:
+    if(e->op == RING_CLOSE){
+      // the descriptor is gone now; the worker drops the file.
+      if((r->f = fdremove(p, e->fd)) == 0)
+        return 0;
+    } else {
+      if((f = fdget(p, e->fd)) == 0)
+        return 0;
+      r->f = filedup(f);
+    }
+    return 1;
+  case RING_OPEN:
+    if(fetchstr(e->addr, r->path, MAXPATH) < 0)
+      return 0;
+    r->cwd = idup(p->cwd);
+    return 1;
+  }
+  return 0;
+}
+
+// Drop the references held by r, and free it.
+static void
+ringrelease(struct ringreq *r)
+{
+  if(r->f)
+    fileclose(r->f);
+  if(r->cwd){
+    begin_op();
+    iput(r->cwd);
+    end_op();
+  }
+  acquire(&ringq.lock);
+  r->next = ringq.free;
+  ringq.free = r;
+  release(&ringq.lock);
+}
+
+// Submit up to nsub entries from the current process's
+// submission ring, then wait until at least minc
+// completions are waiting in its completion ring, or
+// nothing is left in flight.
+// Returns the number of entries submitted, or -1.
+int
+ringenter(int nsub, int minc)
+{
+  struct proc *p = myproc();
+  struct uring *u = p->ring;
+  struct ringreq *r;
+  struct sqe e;
+  int i, res;
+
+  if(u == 0)
+    return -1;
+
+  for(i = 0; i < nsub && u->sqtail != p->ringsq; i++){
+    acquire(&ringq.lock);
+    // leave room in the completion ring for
+    // everything in flight.
+    if(p->ringcq + p->ringbusy - u->cqhead >= RINGSIZE ||
+       (r = ringq.free) == 0){
+      release(&ringq.lock);
+      break;
+    }
+    ringq.free = r->next;
+    release(&ringq.lock);
+
+    __sync_synchronize();
+    e = u->sq[p->ringsq % RINGSIZE];
+    p->ringsq++;
+    u->sqhead = p->ringsq;
+
+    if(ringprep(r, &e, &res) == 0){
+      ringrelease(r);
+      acquire(&ringq.lock);
+      ringpost(p, e.data, res);
+      release(&ringq.lock);
+      continue;
+    }
+    acquire(&ringq.lock);
+    p->ringbusy++;
+    r->next = 0;
+    if(ringq.head)
+      ringq.tail->next = r;
+    else
+      ringq.head = r;
+    ringq.tail = r;
+    wakeup(&ringq.head);
+    release(&ringq.lock);
+  }
+
+  acquire(&ringq.lock);
+  while(p->ringcq - u->cqhead < minc && p->ringbusy > 0){
+    if(killed(p)){
+      release(&ringq.lock);
+      return -1;
+    }
+    sleep(&p->ring, &ringq.lock);
+  }
+  release(&ringq.lock);
+  return i;
+}
+
+// Carry out r, as its owner.
+static int
+ringdo(struct ringreq *r)
+{
+  struct proc *p = myproc();
+  struct sqe *e = &r->sqe;
+  pagetable_t pagetable;
+  struct iovec iov;
+  struct file *f;
+  int res = -1;
+
+  pagetable = p->pagetable;
+  p->pagetable = r->owner->pagetable;
+  p->cwd = r->cwd;
+
+  iov.iov_base = (void*)e->addr;
+  iov.iov_len = e->n;
+  switch(e->op){
+  case RING_READ:
+    if(e->off == -1)
+      res = fileread(r->f, e->addr, e->n);
+    else if(e->off >= 0 && e->n >= 0)
+      res = filereadv(r->f, &iov, 1, e->off);
+    break;
+  case RING_WRITE:
+    if(e->off == -1)
+      res = filewrite(r->f, e->addr, e->n);
+    else if(e->off >= 0 && e->n >= 0)
+      res = filewritev(r->f, &iov, 1, e->off);
+    break;
+  case RING_FSTAT:
+    res = filestat(r->f, e->addr);
+    break;
+  case RING_CLOSE:
+    res = 0;
+    break;
+  case RING_OPEN:
+    if((f = fileopen(r->path, e->n)) != 0 && (res = fdinstall(r->owner, f)) < 0)
+      fileclose(f);
+    break;
+  }
+
+  p->cwd = 0;
+  p->pagetable = pagetable;
+  return res;
+}
+
+static void
+ringworker(void)
+{
+  struct proc *p = myproc();
+  struct ringreq *r;
+  int res;
+
+  for(;;){
+    acquire(&ringq.lock);
+    while((r = ringq.head) == 0)
+      sleep(&ringq.head, &ringq.lock);
+    ringq.head = r->next;
+    r->worker = p;
+    // forget a cancellation meant for an earlier request.
+    acquire(&p->lock);
+    p->killed = 0;
+    release(&p->lock);
+    release(&ringq.lock);
+
+    res = ringdo(r);
+
+    acquire(&ringq.lock);
+    r->worker = 0;
+    if(r->owner->ring)
+      ringpost(r->owner, r->sqe.data, res);
+    r->owner->ringbusy--;
+    wakeup(&r->owner->ring);
+    release(&ringq.lock);
+    ringrelease(r);
+  }
+}
+
+// Does r use p's memory in [lo, hi)? All of p's requests do
+// if the range is the whole address space, as at exit().
+static int
+ringuses(struct ringreq *r, uint64 lo, uint64 hi)
+{
+  struct sqe *e = &r->sqe;
+  uint64 n;
+
+  if(lo == 0 && hi == MAXVA)
+    return 1;
+  switch(e->op){
+  case RING_READ:
+  case RING_WRITE:
+    n = e->n;
+    break;
+  case RING_FSTAT:
+    n = sizeof(struct stat);
+    break;
+  default:
+    return 0;
+  }
+  return e->addr < hi && e->addr + n > lo;
+}
+
+// Cancel p's requests that use its memory in [lo, hi), and
+// wait until none are in flight. Requests not yet started
+// are dropped, completing with -1, and running ones are
+// interrupted by killing their worker, which then forgets it
+// was killed.
+static void
+ringdrain(struct proc *p, uint64 lo, uint64 hi)
+{
+  struct ringreq *r, **pp, *dropped;
+  int busy;
+
+  dropped = 0;
+  acquire(&ringq.lock);
+  for(;;){
+    ringq.tail = 0;
+    for(pp = &ringq.head; (r = *pp) != 0; ){
+      if(r->owner == p && ringuses(r, lo, hi)){
+        *pp = r->next;
+        r->next = dropped;
+        dropped = r;
+        p->ringbusy--;
+        ringpost(p, r->sqe.data, -1);
+      } else {
+        ringq.tail = r;
+        pp = &r->next;
+      }
+    }
+    busy = 0;
+    for(r = ringq.req; r < ringq.req+NRINGREQ; r++){
+      if(r->worker && r->owner == p && ringuses(r, lo, hi)){
+        kill(r->worker->pid);
+        busy = 1;
+      }
+    }
+    if(!busy)
+      break;
+    sleep(&p->ring, &ringq.lock);
+  }
+  release(&ringq.lock);
+
+  while((r = dropped) != 0){
+    dropped = r->next;
+    ringrelease(r);
+  }
+}
+
+// Cancel p's requests that use memory in [lo, hi), which
+// p is about to free.
+void
+ringcancel(struct proc *p, uint64 lo, uint64 hi)
+{
+  if(p->ring)
+    ringdrain(p, lo, hi);
+}
+
+// Cancel p's requests and remove its ring.
+// Called by exit() and exec().
+void
+ringexit(struct proc *p)
+{
+  if(p->ring == 0)
+    return;
+  ringdrain(p, 0, MAXVA);
+  uvmunmap(p->pagetable, URING, 1, 1);
+  p->ring = 0;
+}
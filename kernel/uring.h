@@ -0,0 +1,45 @@
+// Submission and completion rings, shared between a process
+// and the kernel by ringsetup(), for batching system calls.
+//
+// The process fills sq[sqtail % RINGSIZE] and advances sqtail,
+// then calls ringenter(); the kernel takes entries from sqhead
+// and hands them to kernel worker threads. As each finishes,
+// the kernel fills cq[cqtail % RINGSIZE] and advances cqtail,
+// and the process takes completions from cqhead on.
+// Completions may arrive in any order.
+
+#define RINGSIZE 64  // entries in each ring
+
+// Operations.
+#define RING_NOP   0
+#define RING_READ  1  // read(fd, addr, n), at off unless off is -1
+#define RING_WRITE 2  // write(fd, addr, n), at off unless off is -1
+#define RING_OPEN  3  // open(addr, n)
+#define RING_CLOSE 4  // close(fd)
+#define RING_FSTAT 5  // fstat(fd, addr)
+
+// A submission queue entry.
+struct sqe {
+  int op;
+  int fd;
+  uint64 addr;  // buffer, path, or struct stat
+  int n;        // byte count, or mode for RING_OPEN
+  int off;      // file offset, or -1
+  uint64 data;  // passed back in the completion
+};
+
+// A completion queue entry.
+struct cqe {
+  uint64 data;  // from the submission
+  int res;      // what the system call would have returned
+  int pad;
+};
+
+struct uring {
+  uint sqhead;  // advanced by the kernel
+  uint sqtail;  // advanced by the process
+  uint cqhead;  // advanced by the process
+  uint cqtail;  // advanced by the kernel
+  struct sqe sq[RINGSIZE];
+  struct cqe cq[RINGSIZE];
+};
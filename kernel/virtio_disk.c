@@ -212,12 +212,13 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// queue a request to read or write b->data from or to
+// block blockno, without waiting for it to finish.
+// caller holds disk.vdisk_lock.
+static void
+virtio_disk_start(struct buf *b, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
@@ -279,18 +280,38 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
-  }
+// read or write n buffers at once, and wait for them all.
+// buffer bs[i] goes to or comes from block blocknos[i],
+// or from its own blockno if blocknos is 0. the device
+// may complete the requests in any order.
+void
+virtio_disk_rwv(struct buf **bs, uint *blocknos, int n, int write)
+{
+  int i;
+
+  acquire(&disk.vdisk_lock);
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  for(i = 0; i < n; i++)
+    virtio_disk_start(bs[i], blocknos ? blocknos[i] : bs[i]->blockno, write);
+
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(i = 0; i < n; i++){
+    while(bs[i]->disk == 1) {
+      sleep(bs[i], &disk.vdisk_lock);
+    }
+  }
 
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 0, 1, write);
+}
+
 void
 virtio_disk_intr()
 {
@@ -320,6 +341,11 @@ virtio_disk_intr()
     b->disk = 0;   // disk is done with buf
     wakeup(b);
 
+    // free the descriptors here, not in the waiter, so that a
+    // waiter with many requests in flight cannot run out.
+    disk.info[id].b = 0;
+    free_chain(id);
+
     disk.used_idx += 1;
   }
 
@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog;     // Number of log blocks, header included
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -89,6 +89,14 @@ main(int argc, char *argv[])
   if(fsfd < 0)
     die(argv[1]);
 
+  // Give the log a sixteenth of the disk, as much as
+  // the kernel can use: a header block plus LOGSIZE.
+  nlog = FSSIZE / 16;
+  if(nlog > 1 + LOGSIZE)
+    nlog = 1 + LOGSIZE;
+  if(nlog < 3*MAXOPBLOCKS + 1)
+    nlog = 3*MAXOPBLOCKS + 1;
+
   // 1 fs block = 1 disk sector
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
@@ -0,0 +1,47 @@
+// Print the buffer cache's counters.
+//
+//   bcstat [command [args]]
+//
+// With a command, run it and print how the counters
+// changed while it ran.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat b0, b1;
+  int pid;
+
+  if(bcachestat(&b0) < 0){
+    fprintf(2, "bcstat: bcachestat failed\n");
+    exit(1);
+  }
+
+  if(argc < 2){
+    printf("buffers %d (in %d, hot %d)\n", b0.nbuf, b0.nin, b0.nbuf - b0.nin);
+    printf("hits %l misses %l evictions %l ghost hits %l\n",
+           b0.hits, b0.misses, b0.evictions, b0.ghosthits);
+    exit(0);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "bcstat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv+1);
+    fprintf(2, "bcstat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+
+  bcachestat(&b1);
+  printf("hits %l misses %l evictions %l ghost hits %l\n",
+         b1.hits - b0.hits, b1.misses - b0.misses,
+         b1.evictions - b0.evictions, b1.ghosthits - b0.ghosthits);
+  exit(0);
+}
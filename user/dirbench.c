@@ -0,0 +1,94 @@
+// Time creating, looking up, and deleting many entries in
+// one directory, to exercise hashed directories.
+//
+//   dirbench [n]
+//
+// The entries are hard links to a single file, since the file
+// system has far fewer inodes than the default n.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+
+#define DIR "dirbench.d"
+
+void
+mkname(char *name, int i)
+{
+  char *p;
+
+  p = name + 8;
+  *p = '\0';
+  do {
+    *--p = '0' + i % 10;
+    i /= 10;
+  } while(p > name + 1);
+  name[0] = 'f';
+}
+
+void
+fail(char *what, char *name)
+{
+  printf("dirbench: %s %s failed\n", what, name);
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, fd, t0;
+  char name[9];
+  struct stat st;
+
+  n = 10000;
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  if(mkdir(DIR) < 0 || chdir(DIR) < 0)
+    fail("mkdir", DIR);
+  if((fd = open("target", O_CREATE|O_RDWR)) < 0)
+    fail("create", "target");
+  close(fd);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if(link("target", name) < 0)
+      fail("link", name);
+  }
+  printf("dirbench: create %d entries: %d ticks\n", n, uptime() - t0);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if(stat(name, &st) < 0)
+      fail("stat", name);
+  }
+  for(i = n; i < 2*n; i++){
+    mkname(name, i);
+    if(stat(name, &st) == 0)
+      fail("negative stat", name);
+  }
+  printf("dirbench: look up %d entries, %d absent: %d ticks\n", n, n, uptime() - t0);
+
+  if(stat("target", &st) < 0 || st.nlink != n + 1){
+    printf("dirbench: target has %d links, expected %d\n", st.nlink, n + 1);
+    exit(1);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mkname(name, i);
+    if(unlink(name) < 0)
+      fail("unlink", name);
+  }
+  printf("dirbench: delete %d entries: %d ticks\n", n, uptime() - t0);
+
+  unlink("target");
+  chdir("..");
+  if(unlink(DIR) < 0)
+    fail("unlink", DIR);
+  exit(0);
+}
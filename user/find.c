@@ -9,6 +9,7 @@
 #include "user/user.h"
 
 const int BUFFER_SIZE = 512;
+#define DIRENT_BATCH 16
 
 #define STDERR 2
 
@@ -21,12 +22,61 @@ char* getFileNameFromPath(char path[]) {
     // no need for blank-padded space here!
 }
 
+// path is a directory, open as dirFd; it lives in a buffer of
+// BUFFER_SIZE bytes. getdents() reports each entry's type along
+// with its name, so only subdirectories need to be opened.
+void findInDir(int dirFd, char *path, char *targetName) {
+    char *pathEnd = path + strlen(path);
+    struct direntstat *batch;
+    int n, i;
+
+    if (pathEnd + 1 + DIRSIZ + 1 > path + BUFFER_SIZE) {
+        fprintf(STDERR, "find: path too long: %s\n", path);
+        return;
+    }
+    *pathEnd++ = '/';
+
+    // one batch per directory level; keep it off the small user stack.
+    batch = malloc(DIRENT_BATCH * sizeof(struct direntstat));
+    if (batch == 0) {
+        fprintf(STDERR, "find: out of memory\n");
+        exit(1);
+    }
+
+    while ((n = getdents(dirFd, batch, DIRENT_BATCH * sizeof(struct direntstat), GD_STAT)) > 0) {
+        for (i = 0; i < n / sizeof(struct direntstat); i++) {
+            memmove(pathEnd, batch[i].name, DIRSIZ);
+            pathEnd[DIRSIZ] = '\0';
+
+            if (strcmp(".", pathEnd) == 0 || strcmp("..", pathEnd) == 0) {
+                continue;
+            }
+
+            if (batch[i].st.type == T_FILE) {
+                if (strcmp(pathEnd, targetName) == 0) {
+                    printf("%s\n", path);
+                }
+            } else if (batch[i].st.type == T_DIR) {
+                int subFd = open(path, O_RDONLY);
+                if (subFd < 0) {
+                    fprintf(STDERR, "find: cannot open %s\n", path);
+                    continue;
+                }
+                findInDir(subFd, path, targetName);  // recursive find
+                close(subFd);
+            }
+        }
+    }
+
+    free(batch);
+    pathEnd[-1] = '\0';
+}
+
 void findHelper(char *path, char *targetName) {
     int currentFd;
-    char nextDirBuffer[BUFFER_SIZE];
+    char pathBuffer[BUFFER_SIZE];
 
     struct stat currentStat;
-    struct dirent nextDir;
 
     currentFd = open(path, O_RDONLY);
     if (currentFd < 0) {
@@ -45,25 +95,13 @@ void findHelper(char *path, char *targetName) {
             printf("%s\n", path);
         }
     } else if (currentStat.type == T_DIR) {
-        strcpy(nextDirBuffer, path);
-        char *pathEnd = nextDirBuffer + strlen(nextDirBuffer);
-        *pathEnd = '/';
-        ++pathEnd;
-
-        while (read(currentFd, &nextDir, sizeof(struct dirent)) == sizeof(struct dirent)) {
-            if (nextDir.inum == 0) {
-                continue;
-            }
-
-            if (strcmp(".", nextDir.name) == 0 || strcmp("..", nextDir.name) == 0) {
-                continue;
-            }
-
-            memmove(pathEnd, nextDir.name, DIRSIZ);
-            pathEnd[DIRSIZ] = '\0';
-
-            findHelper(nextDirBuffer, targetName);  // recursive find
+        if (strlen(path) >= BUFFER_SIZE) {
+            fprintf(STDERR, "find: path too long: %s\n", path);
+            close(currentFd);
+            exit(1);
         }
+        strcpy(pathBuffer, path);
+        findInDir(currentFd, pathBuffer, targetName);
     }
 
     close(currentFd);
@@ -26,9 +26,9 @@ fmtname(char *path)
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  char name[DIRSIZ+1];
+  int fd, i, n;
+  struct direntstat ds[16];
   struct stat st;
 
   if((fd = open(path, O_RDONLY)) < 0){
@@ -49,23 +49,12 @@ ls(char *path)
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf("ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
+    while((n = getdents(fd, ds, sizeof(ds), GD_STAT)) > 0){
+      for(i = 0; i < n / sizeof(ds[0]); i++){
+        memmove(name, ds[i].name, DIRSIZ);
+        name[DIRSIZ] = 0;
+        printf("%s %d %d %d\n", fmtname(name), ds[i].st.type, ds[i].st.ino, ds[i].st.size);
       }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
     break;
   }
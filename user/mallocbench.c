@@ -0,0 +1,128 @@
+// Compare malloc() with the Kernighan and Ritchie allocator
+// it replaced (krmalloc.c) on a few allocation patterns.
+//
+//   mallocbench [rounds]
+//
+// For each pattern and allocator, prints the elapsed ticks and
+// how much memory the heap still holds once everything has
+// been freed.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NSLOT 1000
+
+void *krmalloc(uint);
+void krfree(void*);
+
+struct alloc {
+  char *name;
+  void *(*malloc)(uint);
+  void (*free)(void*);
+};
+
+static struct alloc allocs[] = {
+  { "malloc", malloc, free },
+  { "krmalloc", krmalloc, krfree },
+};
+
+static void *slot[NSLOT];
+static uint seed;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+fail(struct alloc *a)
+{
+  printf("mallocbench: %s failed\n", a->name);
+  exit(1);
+}
+
+// Allocate a block and free it straight away.
+void
+lifo(struct alloc *a, int rounds, uint maxsize)
+{
+  void *p;
+  int i;
+
+  for(i = 0; i < rounds * NSLOT; i++){
+    if((p = a->malloc(rand() % maxsize + 1)) == 0)
+      fail(a);
+    a->free(p);
+  }
+}
+
+// Keep NSLOT blocks allocated, replacing a random one each time.
+void
+churn(struct alloc *a, int rounds, uint maxsize)
+{
+  int i, j;
+
+  for(i = 0; i < rounds * NSLOT; i++){
+    j = rand() % NSLOT;
+    if(slot[j])
+      a->free(slot[j]);
+    if((slot[j] = a->malloc(rand() % maxsize + 1)) == 0)
+      fail(a);
+  }
+}
+
+struct pattern {
+  char *name;
+  void (*fn)(struct alloc*, int, uint);
+  uint maxsize;
+};
+
+static struct pattern patterns[] = {
+  { "lifo small", lifo, 128 },
+  { "churn small", churn, 256 },
+  { "churn mixed", churn, 16384 },
+};
+
+// Run pattern p with allocator a in a child, so that each run
+// starts with a fresh heap.
+void
+run(struct pattern *p, struct alloc *a, int rounds)
+{
+  char *brk0;
+  int i, t0, t;
+
+  if(fork() == 0){
+    seed = 1;
+    brk0 = sbrk(0);
+    t0 = uptime();
+    p->fn(a, rounds, p->maxsize);
+    t = uptime() - t0;
+    for(i = 0; i < NSLOT; i++){
+      if(slot[i])
+        a->free(slot[i]);
+    }
+    printf("mallocbench: %s, %s: %d ticks, %d KB held after free\n",
+           p->name, a->name, t, (int)(sbrk(0) - brk0) / 1024);
+    exit(0);
+  }
+  wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int rounds, i, j;
+
+  rounds = 100;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds <= 0)
+    rounds = 1;
+
+  for(i = 0; i < sizeof(patterns)/sizeof(patterns[0]); i++)
+    for(j = 0; j < sizeof(allocs)/sizeof(allocs[0]); j++)
+      run(&patterns[i], &allocs[j], rounds);
+  exit(0);
+}
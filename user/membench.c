@@ -0,0 +1,137 @@
+// Time memset(), memmove(), memcmp() and strlen() from ulib.c,
+// which share their word-at-a-time code with kernel/string.c,
+// against the byte-at-a-time loops they replaced.
+//
+//   membench [megabytes]
+//
+// Each test runs over a 4096-byte buffer, once with the
+// buffers aligned and once with the source one byte off.
+// Rates are in MB/s, taking a clock tick to be 1/10th of a
+// second, as it is in qemu.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define TICKSPERSEC 10
+#define N 4096
+
+static char src[N + 16] __attribute__((aligned(16)));
+static char dst[N + 16] __attribute__((aligned(16)));
+
+void*
+bytemove(void *vdst, const void *vsrc, int n)
+{
+  char *d = vdst;
+  const char *s = vsrc;
+
+  while(n-- > 0)
+    *d++ = *s++;
+  return vdst;
+}
+
+void*
+byteset(void *dst, int c, uint n)
+{
+  char *d = dst;
+
+  while(n-- > 0)
+    *d++ = c;
+  return dst;
+}
+
+int
+bytecmp(const void *v1, const void *v2, uint n)
+{
+  const char *p1 = v1, *p2 = v2;
+
+  while(n-- > 0){
+    if(*p1 != *p2)
+      return *p1 - *p2;
+    p1++, p2++;
+  }
+  return 0;
+}
+
+uint
+bytelen(const char *s)
+{
+  int n;
+
+  for(n = 0; s[n]; n++)
+    ;
+  return n;
+}
+
+// Run test t (0-3) with the byte loops or ulib's functions
+// until total bytes have been processed. Returns the ticks.
+int
+run(int t, int bytes, int off, int total)
+{
+  int i, t0;
+  volatile int sink;
+
+  t0 = uptime();
+  for(i = 0; i < total; i += N){
+    switch(t){
+    case 0:
+      if(bytes)
+        byteset(dst + off, i, N);
+      else
+        memset(dst + off, i, N);
+      break;
+    case 1:
+      if(bytes)
+        bytemove(dst, src + off, N);
+      else
+        memmove(dst, src + off, N);
+      break;
+    case 2:
+      if(bytes)
+        sink = bytecmp(dst, src + off, N);
+      else
+        sink = memcmp(dst, src + off, N);
+      break;
+    case 3:
+      if(bytes)
+        sink = bytelen(src + off);
+      else
+        sink = strlen(src + off);
+      break;
+    }
+  }
+  (void)sink;
+  i = uptime() - t0;
+  return i > 0 ? i : 1;
+}
+
+static char *names[] = { "memset", "memmove", "memcmp", "strlen" };
+
+int
+main(int argc, char *argv[])
+{
+  int mb, total, t, off, tb, tw;
+
+  mb = 16;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb <= 0)
+    mb = 1;
+  total = mb * 1024 * 1024;
+
+  memset(src, 'x', sizeof(src));
+  src[sizeof(src) - 1] = 0;
+  for(t = 0; t < 4; t++){
+    for(off = 0; off < 2; off++){
+      // memcmp must scan the whole buffer to be a fair test.
+      memmove(dst, src + off, N);
+      tb = run(t, 1, off, total);
+      tw = run(t, 0, off, total);
+      printf("membench: %s%s: bytes %d MB/s, words %d MB/s, %d.%dx\n",
+             names[t], off ? " unaligned" : "",
+             mb * TICKSPERSEC / tb, mb * TICKSPERSEC / tw,
+             tb / tw, tb * 10 / tw % 10);
+    }
+  }
+  exit(0);
+}
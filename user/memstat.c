@@ -0,0 +1,26 @@
+// Print the physical memory allocator's free pages, and how
+// many free blocks of each order they make up, to show how
+// fragmented memory is.
+//
+//   memstat
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  struct kmemstat st;
+  int k;
+
+  if(kmemstat(&st) < 0){
+    fprintf(2, "memstat: kmemstat failed\n");
+    exit(1);
+  }
+  printf("free pages %d (zeroed %d)\n", st.nfree, st.nzeroed);
+  printf("order blocks\n");
+  for(k = 0; k <= MAXORDER; k++)
+    printf("%d %d\n", k, st.nblock[k]);
+  exit(0);
+}
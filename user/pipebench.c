@@ -0,0 +1,82 @@
+// Measure pipe bandwidth: a child reads and discards
+// what the parent writes, for a range of write sizes.
+//
+//   pipebench [megabytes]
+//
+// Rates are in MB/s, taking a clock tick to be 1/10th
+// of a second, as it is in qemu.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define TICKSPERSEC 10
+#define MAXWRITE 16384
+
+static int sizes[] = { 1, 64, 512, 4096, MAXWRITE };
+
+void
+fail(char *what)
+{
+  printf("pipebench: %s failed\n", what);
+  exit(1);
+}
+
+// Send total bytes through a pipe in writes of n bytes.
+// Returns the elapsed ticks.
+int
+run(char *buf, int n, int total)
+{
+  int fds[2], pid, i, t0, t;
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  pid = fork();
+  if(pid < 0)
+    fail("fork");
+  if(pid == 0){
+    close(fds[1]);
+    while(read(fds[0], buf, MAXWRITE) > 0)
+      ;
+    exit(0);
+  }
+  close(fds[0]);
+  t0 = uptime();
+  for(i = 0; i < total; i += n){
+    if(write(fds[1], buf, n) != n)
+      fail("write");
+  }
+  close(fds[1]);
+  wait(0);
+  t = uptime() - t0;
+  return t > 0 ? t : 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb, i, n, total, t, rate;
+  char *buf;
+
+  mb = 4;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb <= 0)
+    mb = 1;
+  if((buf = malloc(MAXWRITE)) == 0)
+    fail("malloc");
+  memset(buf, 'x', MAXWRITE);
+
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    n = sizes[i];
+    // one-byte writes are slow; send less.
+    total = (n < 64 ? mb * 1024 * 1024 / 64 : mb * 1024 * 1024);
+    total -= total % n;
+    t = run(buf, n, total);
+    // tenths of a MB/s.
+    rate = (uint64)total * 10 * TICKSPERSEC / t / (1024 * 1024);
+    printf("pipebench: %d bytes in writes of %d: %d ticks, %d.%d MB/s\n",
+           total, n, t, rate / 10, rate % 10);
+  }
+  exit(0);
+}
@@ -6,14 +6,37 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// The output of one printf call. It collects in buf, which
+// goes to fd's stdio stream, if it has one, or else straight
+// to fd, in as few writes as possible.
+struct out {
+  int fd;
+  int n;
+  char buf[128];
+};
+
+static void
+flush(struct out *o)
+{
+  if(o->fd == 1)
+    fwrite(o->buf, 1, o->n, stdout);
+  else if(o->fd == 2)
+    fwrite(o->buf, 1, o->n, stderr);
+  else
+    write(o->fd, o->buf, o->n);
+  o->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct out *o, char c)
 {
-  write(fd, &c, 1);
+  if(o->n == sizeof(o->buf))
+    flush(o);
+  o->buf[o->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *o, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,25 +58,28 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(o, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct out *o, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(o, '0');
+  putc(o, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(o, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+  struct out o;
   char *s;
   int c, i, state;
 
+  o.fd = fd;
+  o.n = 0;
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -61,37 +87,38 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(&o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(&o, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(&o, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(&o, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(&o, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(&o, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(&o, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(&o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(&o, '%');
+        putc(&o, c);
       }
       state = 0;
     }
   }
+  flush(&o);
 }
 
 void
@@ -0,0 +1,205 @@
+// Buffered standard I/O streams.
+//
+// Output collects in a stream's buffer and reaches the kernel
+// in one write() per buffer (or per line), instead of one
+// write() per character; input is read a buffer at a time.
+//
+// stdout is line buffered if it is the console and fully
+// buffered otherwise. stderr is unbuffered, though printf()
+// still hands each call's output to the kernel in one write().
+// fork(), exec() and exit() in ulib.c flush every stream first,
+// so buffered output is neither duplicated nor lost.
+//
+// stdin reads ahead, so input it has buffered is no longer
+// there for a child that reads the same file descriptor.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define BUFSIZ 512
+
+struct iobuf {
+  int fd;
+  int mode;     // _IOFBF, _IOLBF, _IONBF, or 0 until first use
+  char *buf;
+  int size;
+  int n;        // bytes in buf
+  int r;        // next byte of buf to read (input only)
+};
+
+static char inbuf[BUFSIZ];
+static char outbuf[BUFSIZ];
+static char errbuf[BUFSIZ];
+
+static struct iobuf iob[3] = {
+  { 0, _IOFBF, inbuf, BUFSIZ },
+  { 1, 0, outbuf, BUFSIZ },
+  { 2, _IONBF, errbuf, BUFSIZ },
+};
+
+FILE *stdin = &iob[0];
+FILE *stdout = &iob[1];
+FILE *stderr = &iob[2];
+
+// Write out f's buffered output.
+// Returns -1 if the write failed; the output is dropped.
+static int
+flush1(FILE *f)
+{
+  int i, cc;
+
+  for(i = 0; i < f->n; i += cc){
+    if((cc = write(f->fd, f->buf + i, f->n - i)) <= 0){
+      f->n = 0;
+      return -1;
+    }
+  }
+  f->n = 0;
+  return 0;
+}
+
+// Flush f, or all output streams if f is 0.
+int
+fflush(FILE *f)
+{
+  int r;
+
+  if(f)
+    return flush1(f);
+  r = flush1(stdout);
+  if(flush1(stderr) < 0)
+    r = -1;
+  return r;
+}
+
+// Choose stdout's buffering on first use.
+static void
+setmode(FILE *f)
+{
+  struct stat st;
+
+  if(fstat(f->fd, &st) == 0 && st.type == T_DEVICE)
+    f->mode = _IOLBF;
+  else
+    f->mode = _IOFBF;
+}
+
+// Use buf (if not 0) of size bytes for f, buffered according
+// to mode. Flushes any output f already holds.
+int
+setvbuf(FILE *f, char *buf, int mode, uint size)
+{
+  if(mode != _IOFBF && mode != _IOLBF && mode != _IONBF)
+    return -1;
+  if(flush1(f) < 0)
+    return -1;
+  if(buf){
+    f->buf = buf;
+    f->size = size;
+  }
+  f->mode = mode;
+  f->r = 0;
+  return 0;
+}
+
+// Append n bytes to f's buffer, writing the buffer out
+// whenever it fills and, if line buffered, after a newline.
+static int
+put(FILE *f, const char *p, int n)
+{
+  int i, m, nl;
+
+  if(f->mode == 0)
+    setmode(f);
+  nl = 0;
+  while(n > 0){
+    m = f->size - f->n;
+    if(m > n)
+      m = n;
+    memmove(f->buf + f->n, p, m);
+    for(i = 0; f->mode == _IOLBF && !nl && i < m; i++)
+      nl = p[i] == '\n';
+    f->n += m;
+    p += m;
+    n -= m;
+    if(f->n == f->size && flush1(f) < 0)
+      return -1;
+  }
+  if(f->mode == _IONBF || nl)
+    return flush1(f);
+  return 0;
+}
+
+int
+fputc(int c, FILE *f)
+{
+  char ch;
+
+  ch = c;
+  if(put(f, &ch, 1) < 0)
+    return EOF;
+  return c & 0xff;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+  return put(f, s, strlen(s));
+}
+
+uint
+fwrite(const void *p, uint size, uint n, FILE *f)
+{
+  if(put(f, p, size * n) < 0)
+    return 0;
+  return n;
+}
+
+int
+fgetc(FILE *f)
+{
+  if(f->r == f->n){
+    // A prompt written without a newline should appear
+    // before the program waits for the answer.
+    if(f == stdin && stdout->mode == _IOLBF)
+      flush1(stdout);
+    f->r = f->n = 0;
+    if(f->mode == _IONBF)
+      f->n = read(f->fd, f->buf, 1);
+    else
+      f->n = read(f->fd, f->buf, f->size);
+    if(f->n <= 0){
+      f->n = 0;
+      return EOF;
+    }
+  }
+  return f->buf[f->r++] & 0xff;
+}
+
+// Read a line of at most max-1 bytes, including the newline.
+// Returns 0 if there was nothing left to read.
+char*
+fgets(char *buf, int max, FILE *f)
+{
+  int i, c;
+
+  for(i = 0; i+1 < max; ){
+    if((c = fgetc(f)) == EOF)
+      break;
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  if(i == 0)
+    return 0;
+  return buf;
+}
+
+char*
+gets(char *buf, int max)
+{
+  fgets(buf, max, stdin);
+  return buf;
+}
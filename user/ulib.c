@@ -14,6 +14,37 @@ _main()
   exit(0);
 }
 
+// stdio.c, if the program is linked with it.
+int fflush(FILE*) __attribute__((weak));
+
+// fork(), exec() and exit() flush buffered output first, so that
+// a child doesn't inherit and repeat it, and exec() and exit()
+// don't discard it.
+
+int
+fork(void)
+{
+  if(fflush)
+    fflush(0);
+  return _fork();
+}
+
+int
+exec(const char *path, char **argv)
+{
+  if(fflush)
+    fflush(0);
+  return _exec(path, argv);
+}
+
+int
+exit(int status)
+{
+  if(fflush)
+    fflush(0);
+  _exit(status);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -33,24 +64,57 @@ strcmp(const char *p, const char *q)
   return (uchar)*p - (uchar)*q;
 }
 
+// strlen(), memset(), memmove() and memcmp() work a 64-bit word
+// at a time where alignment allows, like their counterparts in
+// kernel/string.c.
+
+// A uint64 that may alias any other type.
+typedef uint64 __attribute__((may_alias)) word;
+
+#define WSIZE sizeof(word)
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
 uint
 strlen(const char *s)
 {
-  int n;
-
-  for(n = 0; s[n]; n++)
+  const char *p;
+  const word *w;
+
+  for(p = s; (uint64)p % WSIZE; p++)
+    if(*p == 0)
+      return p - s;
+  // A word holds a zero byte if subtracting one from each byte
+  // borrows into the high bit of a byte whose high bit was clear.
+  for(w = (const word*)p; ((*w - ONES) & ~*w & HIGHS) == 0; w++)
     ;
-  return n;
+  for(p = (const char*)w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
-  char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  char *d = (char *) dst;
+  word *wd;
+  uint64 w;
+
+  if(n >= 2*WSIZE){
+    for(; (uint64)d % WSIZE; n--)
+      *d++ = c;
+    w = (uchar)c * ONES;
+    wd = (word*)d;
+    for(; n >= 8*WSIZE; n -= 8*WSIZE, wd += 8){
+      wd[0] = w; wd[1] = w; wd[2] = w; wd[3] = w;
+      wd[4] = w; wd[5] = w; wd[6] = w; wd[7] = w;
+    }
+    for(; n >= WSIZE; n -= WSIZE)
+      *wd++ = w;
+    d = (char*)wd;
   }
+  while(n-- > 0)
+    *d++ = c;
   return dst;
 }
 
@@ -63,24 +127,6 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
@@ -111,15 +157,55 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  word *wd;
+  const word *ws;
+  uint64 a, b;
+  int sh;
 
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if(n >= 4*WSIZE){
+      for(; (uint64)dst % WSIZE; n--)
+        *dst++ = *src++;
+      wd = (word*)dst;
+      if((uint64)src % WSIZE == 0){
+        ws = (const word*)src;
+        for(; n >= 8*WSIZE; n -= 8*WSIZE, wd += 8, ws += 8){
+          wd[0] = ws[0]; wd[1] = ws[1]; wd[2] = ws[2]; wd[3] = ws[3];
+          wd[4] = ws[4]; wd[5] = ws[5]; wd[6] = ws[6]; wd[7] = ws[7];
+        }
+        for(; n >= WSIZE; n -= WSIZE)
+          *wd++ = *ws++;
+      } else {
+        // src is not aligned: build each word of dst from the
+        // two aligned words of src it straddles.
+        sh = ((uint64)src % WSIZE) * 8;
+        ws = (const word*)(src - (uint64)src % WSIZE);
+        a = *ws++;
+        for(; n >= WSIZE; n -= WSIZE){
+          b = *ws++;
+          *wd++ = (a >> sh) | (b << (64 - sh));
+          a = b;
+        }
+      }
+      src += (char*)wd - dst;
+      dst = (char*)wd;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(n >= 2*WSIZE && (uint64)src % WSIZE == (uint64)dst % WSIZE){
+      for(; (uint64)dst % WSIZE; n--)
+        *--dst = *--src;
+      for(; n >= WSIZE; n -= WSIZE){
+        dst -= WSIZE;
+        src -= WSIZE;
+        *(word*)dst = *(const word*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -130,6 +216,14 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if(n >= WSIZE && (uint64)p1 % WSIZE == (uint64)p2 % WSIZE){
+    for(; (uint64)p1 % WSIZE; n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    // Skip equal words; the bytes below find the difference.
+    for(; n >= WSIZE && *(word*)p1 == *(word*)p2; n -= WSIZE)
+      p1 += WSIZE, p2 += WSIZE;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -2,89 +2,283 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// The heap is carved into spans: runs of whole pages, each
+// starting with a struct span. A span is free, holds one large
+// block, or is a slab of equal-sized objects of one small size
+// class. Every block returned by malloc() is preceded by a
+// header naming its span, so free() is O(1).
+//
+// Each small class keeps a list of its slabs that have free
+// objects, so small malloc() is O(1) too. Large blocks, and new
+// slabs, come from the list of free spans by first fit.
+// Free spans coalesce with their free neighbours, and a large
+// free span at the top of the heap is given back with a
+// negative sbrk(), as long as nobody else has moved the break.
 
 typedef long Align;
 
+// Per-block header, 16 bytes to keep blocks 16-byte aligned.
 union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+  struct span *span;    // while allocated
+  union header *next;   // while on a slab's free list
+  Align x[2];
 };
 
 typedef union header Header;
 
-static Header base;
-static Header *freep;
+#define FREE   -1
+#define LARGE  -2
 
-void
-free(void *ap)
+struct span {
+  struct span *below;   // adjacent span at a lower address, or 0
+  struct span *above;   // adjacent span at a higher address, or 0
+  struct span *next;    // on the free span list or a class's list
+  struct span *prev;
+  Header *objs;         // freed objects, if a slab
+  uint npages;
+  int cls;              // FREE, LARGE, or small size class
+  uint nfree;           // free objects, if a slab
+  uint nobj;            // all objects, if a slab
+  uint nnew;            // objects never yet handed out
+};
+
+// sizeof(struct span), rounded up to keep blocks aligned.
+#define SPANHDR 64
+
+// Small size classes, counting the header. A slab of class c
+// spans enough pages to hold at least 7 objects. An empty slab
+// goes straight back to the free spans.
+#define NCLASS 7
+static uint clsize[NCLASS] = { 32, 64, 128, 256, 512, 1024, 2048 };
+static uint clpages[NCLASS] = { 1, 1, 1, 1, 1, 2, 4 };
+
+#define MINGROW  16     // pages to ask sbrk() for at a time
+#define TRIMPAGES 64    // trim a free top span bigger than this
+#define KEEPPAGES 16    // leaving this many pages
+#define MAXPAGES (0x7fffffff / PGSIZE)  // most sbrk() can add
+
+static struct span *freespans;          // free spans
+static struct span *partial[NCLASS];    // slabs with free objects
+static struct span *top;                // highest span in the heap
+static char *end;                       // end of the heap
+
+static void
+push(struct span **list, struct span *s)
 {
-  Header *bp, *p;
+  s->prev = 0;
+  s->next = *list;
+  if(*list)
+    (*list)->prev = s;
+  *list = s;
+}
 
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+static void
+unlink1(struct span **list, struct span *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
 }
 
-static Header*
-morecore(uint nu)
+// Give the excess of a large free span at the top of the heap
+// back to the kernel.
+static void
+trim(struct span *s)
 {
+  uint n;
+
+  if(s != top || s->npages <= TRIMPAGES || sbrk(0) != end)
+    return;
+  n = s->npages - KEEPPAGES;
+  if(sbrk(-(int)(n * PGSIZE)) == (char*)-1)
+    return;
+  s->npages = KEEPPAGES;
+  end -= n * PGSIZE;
+}
+
+// Mark s free, merging it with free neighbours.
+// Returns the merged span.
+static struct span*
+putspan(struct span *s)
+{
+  struct span *t;
+
+  s->cls = FREE;
+  if((t = s->above) && t->cls == FREE){
+    unlink1(&freespans, t);
+    s->npages += t->npages;
+    s->above = t->above;
+    if(s->above)
+      s->above->below = s;
+    if(top == t)
+      top = s;
+  }
+  if((t = s->below) && t->cls == FREE){
+    unlink1(&freespans, t);
+    t->npages += s->npages;
+    t->above = s->above;
+    if(t->above)
+      t->above->below = t;
+    if(top == s)
+      top = t;
+    s = t;
+  }
+  push(&freespans, s);
+  return s;
+}
+
+// Add at least npages to the heap, as a free span.
+static int
+grow(uint npages)
+{
+  struct span *s;
   char *p;
-  Header *hp;
+  uint n, a;
+
+  // Start on a page boundary, in case someone else moved the
+  // break, so that blocks stay aligned.
+  if((a = (uint64)sbrk(0) % PGSIZE) != 0 && sbrk(PGSIZE - a) == (char*)-1)
+    return -1;
+  n = npages < MINGROW ? MINGROW : npages;
+  if((p = sbrk(n * PGSIZE)) == (char*)-1){
+    // Maybe there's room for just what was asked for.
+    n = npages;
+    if((p = sbrk(n * PGSIZE)) == (char*)-1)
+      return -1;
+  }
+  s = (struct span*)p;
+  s->npages = n;
+  s->above = 0;
+  s->below = 0;
+  // Only memory contiguous with the old heap can merge with it.
+  if(p == end && top){
+    s->below = top;
+    top->above = s;
+  }
+  top = s;
+  end = p + n * PGSIZE;
+  putspan(s);
+  return 0;
+}
+
+// Take a span of npages off the free list, splitting off
+// and keeping any remainder.
+static struct span*
+getspan(uint npages)
+{
+  struct span *s, *r;
+
+  for(;;){
+    for(s = freespans; s; s = s->next)
+      if(s->npages >= npages)
+        break;
+    if(s)
+      break;
+    if(grow(npages) < 0)
+      return 0;
+  }
+  unlink1(&freespans, s);
+  if(s->npages > npages){
+    r = (struct span*)((char*)s + npages * PGSIZE);
+    r->npages = s->npages - npages;
+    r->cls = FREE;
+    r->below = s;
+    r->above = s->above;
+    if(r->above)
+      r->above->below = r;
+    s->above = r;
+    if(top == s)
+      top = r;
+    s->npages = npages;
+    push(&freespans, r);
+  }
+  return s;
+}
+
+// Make a new slab for class c, with all its objects free.
+// The objects are handed out from the end of the slab down,
+// so that making a slab costs the same whatever its class.
+static struct span*
+newslab(int c)
+{
+  struct span *s;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  if((s = getspan(clpages[c])) == 0)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  s->cls = c;
+  s->objs = 0;
+  s->nobj = (s->npages * PGSIZE - SPANHDR) / clsize[c];
+  s->nfree = s->nobj;
+  s->nnew = s->nobj;
+  push(&partial[c], s);
+  return s;
+}
+
+void
+free(void *ap)
+{
+  struct span *s;
+  Header *h;
+  int c;
+
+  if(ap == 0)
+    return;
+  h = (Header*)ap - 1;
+  s = h->span;
+  if(s->cls == LARGE){
+    trim(putspan(s));
+    return;
+  }
+  c = s->cls;
+  h->next = s->objs;
+  s->objs = h;
+  if(s->nfree++ == 0)
+    push(&partial[c], s);
+  if(s->nfree == s->nobj){
+    unlink1(&partial[c], s);
+    trim(putspan(s));
+  }
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct span *s;
+  Header *h;
+  uint64 n;
+  int c;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  n = (uint64)nbytes + sizeof(Header);
+  for(c = 0; c < NCLASS; c++)
+    if(n <= clsize[c])
+      break;
+  if(c == NCLASS){
+    n = (n + SPANHDR + PGSIZE - 1) / PGSIZE;
+    if(n > MAXPAGES || (s = getspan(n)) == 0)
+      return 0;
+    s->cls = LARGE;
+    h = (Header*)((char*)s + SPANHDR);
+    h->span = s;
+    return (void*)(h + 1);
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  if((s = partial[c]) == 0 && (s = newslab(c)) == 0)
+    return 0;
+  if(s->nnew > 0){
+    s->nnew--;
+    h = (Header*)((char*)s + SPANHDR + s->nnew * clsize[c]);
+  } else {
+    h = s->objs;
+    s->objs = h->next;
   }
+  if(--s->nfree == 0)
+    unlink1(&partial[c], s);
+  h->span = s;
+  return (void*)(h + 1);
 }
@@ -1,4 +1,9 @@
 struct stat;
+struct bcachestat;
+struct kmemstat;
+struct iovec;
+struct pollfd;
+struct uring;
 
 // system calls
 int fork(void);
@@ -22,6 +27,27 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int getdents(int, void*, int, int);
+int bcachestat(struct bcachestat*);
+int fsync(int);
+int fdatasync(int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int sendfile(int, int, int);
+int splice(int, int, int);
+int vmsplice(int, void*, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
+struct uring* ringsetup(void);
+int ringenter(int, int);
+int kmemstat(struct kmemstat*);
+// the raw system calls; fork(), exit() and exec() in ulib.c
+// flush stdio buffers and then call these.
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
+int _exec(const char*, char**);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -29,9 +55,6 @@ char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void fprintf(int, const char*, ...);
-void printf(const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
@@ -39,3 +62,23 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// printf.c
+void fprintf(int, const char*, ...);
+void printf(const char*, ...);
+
+// stdio.c
+#define EOF (-1)
+#define _IOFBF 1  // fully buffered
+#define _IOLBF 2  // line buffered
+#define _IONBF 3  // unbuffered
+typedef struct iobuf FILE;
+extern FILE *stdin, *stdout, *stderr;
+int fflush(FILE*);
+int setvbuf(FILE*, char*, int, uint);
+int fputc(int, FILE*);
+int fputs(const char*, FILE*);
+uint fwrite(const void*, uint, uint, FILE*);
+int fgetc(FILE*);
+char* fgets(char*, int, FILE*);
+char* gets(char*, int max);
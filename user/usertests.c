@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/uring.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -1916,11 +1917,1083 @@ dirfile(char *s)
   close(fd);
 }
 
+// does the directory name cache notice names that come and go,
+// and forget about directories that are removed?
+void
+namecache(char *s)
+{
+  int fd, i;
+  struct stat st, dot;
+
+  if(stat(".", &dot) < 0){
+    printf("%s: stat . failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3; i++){
+    if(mkdir("nc") != 0){
+      printf("%s: mkdir nc failed\n", s);
+      exit(1);
+    }
+    if(open("nc/f", O_RDONLY) >= 0){
+      printf("%s: open nc/f succeeded before create\n", s);
+      exit(1);
+    }
+    fd = open("nc/f", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create nc/f failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(stat("nc/f", &st) < 0 || st.type != T_FILE){
+      printf("%s: stat nc/f after create failed\n", s);
+      exit(1);
+    }
+    if(stat("nc/..", &st) < 0 || st.ino != dot.ino){
+      printf("%s: nc/.. is not .\n", s);
+      exit(1);
+    }
+    if(unlink("nc/f") != 0){
+      printf("%s: unlink nc/f failed\n", s);
+      exit(1);
+    }
+    if(open("nc/f", O_RDONLY) >= 0){
+      printf("%s: open nc/f succeeded after unlink\n", s);
+      exit(1);
+    }
+    if(unlink("nc") != 0){
+      printf("%s: unlink nc failed\n", s);
+      exit(1);
+    }
+    if(chdir("nc") == 0){
+      printf("%s: chdir nc succeeded after unlink\n", s);
+      exit(1);
+    }
+  }
+}
+
+// getdents() returns the same entries a read() of the directory
+// does, skipping empty slots, and GD_STAT fills in each type.
+void
+getdentstest(char *s)
+{
+  int fd, i, n, nread, ngd, sawfile, sawdir;
+  struct dirent de;
+  struct direntstat ds[4];
+
+  if(mkdir("gd") != 0){
+    printf("%s: mkdir gd failed\n", s);
+    exit(1);
+  }
+  fd = open("gd/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create gd/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(mkdir("gd/d") != 0 || mkdir("gd/x") != 0 || unlink("gd/x") != 0){
+    printf("%s: mkdir gd/d failed\n", s);
+    exit(1);
+  }
+
+  fd = open("gd", O_RDONLY);
+  nread = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      nread++;
+  close(fd);
+
+  fd = open("gd", O_RDONLY);
+  ngd = sawfile = sawdir = 0;
+  // a small buffer forces several calls.
+  while((n = getdents(fd, ds, sizeof(ds), GD_STAT)) > 0){
+    for(i = 0; i < n / sizeof(ds[0]); i++){
+      ngd++;
+      if(ds[i].inum == 0 || ds[i].st.ino != ds[i].inum){
+        printf("%s: bad getdents entry\n", s);
+        exit(1);
+      }
+      if(strcmp(ds[i].name, "f") == 0 && ds[i].st.type == T_FILE)
+        sawfile = 1;
+      if(strcmp(ds[i].name, "d") == 0 && ds[i].st.type == T_DIR)
+        sawdir = 1;
+    }
+  }
+  if(n < 0 || ngd != nread || ngd != 4 || !sawfile || !sawdir){
+    printf("%s: getdents found %d entries, read found %d\n", s, ngd, nread);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("gd/f", O_RDONLY);
+  if(getdents(fd, ds, sizeof(ds), 0) >= 0){
+    printf("%s: getdents on a file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  unlink("gd/f");
+  unlink("gd/d");
+  unlink("gd");
+}
+
+// reading a file a second time should find all of
+// its blocks in the buffer cache.
+void
+bcachetest(char *s)
+{
+  int fd, i, pass;
+  struct bcachestat b0, b1;
+
+  fd = open("bcache", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create bcache failed\n", s);
+    exit(1);
+  }
+  memset(buf, 'b', BSIZE);
+  for(i = 0; i < 8; i++){
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write bcache failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  for(pass = 0; pass < 2; pass++){
+    if(bcachestat(&b0) < 0){
+      printf("%s: bcachestat failed\n", s);
+      exit(1);
+    }
+    fd = open("bcache", O_RDONLY);
+    if(fd < 0){
+      printf("%s: open bcache failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < 8; i++){
+      if(read(fd, buf, BSIZE) != BSIZE){
+        printf("%s: read bcache failed\n", s);
+        exit(1);
+      }
+    }
+    close(fd);
+    bcachestat(&b1);
+  }
+  if(b1.misses != b0.misses || b1.hits < b0.hits + 8){
+    printf("%s: reread had %d misses, %d hits\n", s,
+           (int)(b1.misses - b0.misses), (int)(b1.hits - b0.hits));
+    exit(1);
+  }
+  if(b1.nbuf < b1.nin || b1.nbuf <= 0){
+    printf("%s: bad buffer counts\n", s);
+    exit(1);
+  }
+  unlink("bcache");
+}
+
+// fsync() and fdatasync() work on files, and
+// fail on pipes and bad descriptors.
+void
+fsynctest(char *s)
+{
+  int fd, fds[2];
+
+  fd = open("fsync", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsync failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "hello", 5) != 5){
+    printf("%s: write fsync failed\n", s);
+    exit(1);
+  }
+  if(fsync(fd) != 0 || fdatasync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  // nothing left to commit.
+  if(fsync(fd) != 0){
+    printf("%s: second fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) >= 0){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) >= 0){
+    printf("%s: fsync of pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("fsync");
+}
+
+// pread() and pwrite() at offsets, readv() and writev().
+void
+preadvtest(char *s)
+{
+  int fd, fds[2];
+  char a[4], b[6], c[8], buf[32];
+  struct iovec iov[3];
+
+  fd = open("preadv", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create preadv failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "abc";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "defghij";
+  iov[2].iov_len = 7;
+  if(writev(fd, iov, 3) != 10){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 4, 2) != 4 || memcmp(buf, "cdef", 4) != 0){
+    printf("%s: pread wrong data\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, sizeof(buf), 8) != 2 || pread(fd, buf, 1, 10) != 0){
+    printf("%s: pread at end wrong\n", s);
+    exit(1);
+  }
+  // neither pread() nor pwrite() moves the offset.
+  if(pwrite(fd, "XY", 2, 1) != 2 || write(fd, "k", 1) != 1){
+    printf("%s: pwrite failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("preadv", O_RDONLY);
+  iov[0].iov_base = a;
+  iov[0].iov_len = 3;
+  iov[1].iov_base = b;
+  iov[1].iov_len = 5;
+  iov[2].iov_base = c;
+  iov[2].iov_len = 8;
+  if(readv(fd, iov, 3) != 11){
+    printf("%s: readv wrong count\n", s);
+    exit(1);
+  }
+  if(memcmp(a, "aXY", 3) != 0 || memcmp(b, "defgh", 5) != 0 || memcmp(c, "ijk", 3) != 0){
+    printf("%s: readv wrong data\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "z", 1, 0) >= 0 || pread(fd, buf, 1, -1) >= 0){
+    printf("%s: bad pwrite/pread succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(pread(fds[0], buf, 1, 0) >= 0){
+    printf("%s: pread of pipe succeeded\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "ab";
+  iov[0].iov_len = 2;
+  iov[1].iov_base = "cd";
+  iov[1].iov_len = 2;
+  if(writev(fds[1], iov, 2) != 4 || read(fds[0], buf, sizeof(buf)) != 4 ||
+     memcmp(buf, "abcd", 4) != 0){
+    printf("%s: writev to pipe failed\n", s);
+    exit(1);
+  }
+  // data that exactly fills the first segment: readv must not
+  // then wait for more.
+  write(fds[1], "ef", 2);
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 2;
+  iov[1].iov_base = buf + 2;
+  iov[1].iov_len = 2;
+  if(readv(fds[0], iov, 2) != 2 || memcmp(buf, "ef", 2) != 0){
+    printf("%s: readv of pipe wrong\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("preadv");
+}
+
+// sendfile() from a file to a file and to a pipe.
+void
+sendfiletest(char *s)
+{
+  enum { SZ = 3*BSIZE + 100 };
+  int fd, fd2, fds[2], i, n, tot;
+  char *b;
+
+  b = malloc(SZ);
+  for(i = 0; i < SZ; i++)
+    b[i] = 'a' + i % 23;
+  fd = open("sendfile1", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, b, SZ) != SZ){
+    printf("%s: create sendfile1 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("sendfile1", O_RDONLY);
+  fd2 = open("sendfile2", O_CREATE|O_RDWR);
+  if(fd < 0 || fd2 < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  // start at an unaligned offset.
+  if(read(fd, b, 10) != 10){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  if((n = sendfile(fd2, fd, SZ)) != SZ - 10){
+    printf("%s: sendfile copied %d, not %d\n", s, n, SZ - 10);
+    exit(1);
+  }
+  if(sendfile(fd2, fd, SZ) != 0){
+    printf("%s: sendfile at end of file\n", s);
+    exit(1);
+  }
+  if(sendfile(fd2, fd2, 1) >= 0){
+    printf("%s: sendfile to itself succeeded\n", s);
+    exit(1);
+  }
+  close(fd2);
+  fd2 = open("sendfile2", O_RDONLY);
+  if(read(fd2, b, SZ) != SZ - 10){
+    printf("%s: sendfile2 wrong size\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ - 10; i++){
+    if(b[i] != 'a' + (i + 10) % 23){
+      printf("%s: sendfile2 wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  // to a pipe, with a reader; from a pipe is not allowed.
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(sendfile(fd2, fds[0], 1) >= 0){
+    printf("%s: sendfile from pipe succeeded\n", s);
+    exit(1);
+  }
+  if(fork() == 0){
+    close(fds[0]);
+    close(fd2);
+    fd = open("sendfile1", O_RDONLY);
+    if(sendfile(fds[1], fd, SZ) != SZ)
+      exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], b + tot, SZ - tot)) > 0)
+    tot += n;
+  wait(&i);
+  if(i != 0 || tot != SZ || b[SZ-1] != 'a' + (SZ-1) % 23){
+    printf("%s: sendfile to pipe failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fd);
+  close(fd2);
+  free(b);
+  unlink("sendfile1");
+  unlink("sendfile2");
+}
+
+// resize a pipe, and splice() and vmsplice() through it.
+void
+splicetest(char *s)
+{
+  int fds[2], fd, i, n;
+  char *a, *b;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != PGSIZE){
+    printf("%s: wrong initial pipe size\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 3*PGSIZE) != 4*PGSIZE ||
+     fcntl(fds[0], F_SETPIPE_SZ, 1000*PGSIZE) >= 0){
+    printf("%s: F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+
+  // page-aligned buffers for vmsplice().
+  a = sbrk(5*PGSIZE);
+  a = (char*)PGROUNDUP((uint64)a);
+  b = a + 2*PGSIZE;
+  for(i = 0; i < 2*PGSIZE; i++)
+    a[i] = i % 251;
+  // the pages move into the pipe, and a gets zeroed pages.
+  if(vmsplice(fds[1], a, 2*PGSIZE) != 2*PGSIZE || write(fds[1], "wxyz", 4) != 4){
+    printf("%s: vmsplice write failed\n", s);
+    exit(1);
+  }
+  if(a[1] != 0 || a[PGSIZE+1] != 0){
+    printf("%s: vmsplice did not trade pages\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, PGSIZE) >= 0){
+    printf("%s: shrank a full pipe\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, 16*PGSIZE) != 16*PGSIZE){
+    printf("%s: grow full pipe failed\n", s);
+    exit(1);
+  }
+  if((n = vmsplice(fds[0], b, 2*PGSIZE)) != 2*PGSIZE){
+    printf("%s: vmsplice read %d\n", s, n);
+    exit(1);
+  }
+  for(i = 0; i < 2*PGSIZE; i++){
+    if(b[i] != i % 251){
+      printf("%s: vmsplice wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(read(fds[0], b, 10) != 4 || memcmp(b, "wxyz", 4) != 0){
+    printf("%s: read after vmsplice failed\n", s);
+    exit(1);
+  }
+
+  // file -> pipe -> file.
+  fd = open("splice", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, a + 2*PGSIZE, 1) != 1){
+    printf("%s: create splice failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*BSIZE; i++)
+    b[i] = 'a' + i % 26;
+  if(write(fd, b, 3*BSIZE) != 3*BSIZE){
+    printf("%s: write splice failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("splice", O_RDONLY);
+  read(fd, a, 1);
+  if((n = splice(fd, fds[1], 3*BSIZE + 5)) != 3*BSIZE){
+    printf("%s: splice from file moved %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+  fd = open("splice2", O_CREATE|O_RDWR);
+  if(splice(fds[0], fd, 3*BSIZE + 5) != 3*BSIZE ||
+     splice(fd, fd, 1) >= 0){
+    printf("%s: splice to file failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("splice2", O_RDONLY);
+  memset(a, 0, 3*BSIZE);
+  if(read(fd, a, 3*BSIZE + 5) != 3*BSIZE || memcmp(a, b, 3*BSIZE) != 0){
+    printf("%s: splice2 wrong data\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[0]);
+  close(fds[1]);
+  unlink("splice");
+  unlink("splice2");
+}
+
+// poll() of pipes and files.
+void
+polltest(char *s)
+{
+  int a[2], b[2], fd, pid, xst;
+  struct pollfd pfd[4];
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = a[1];
+  pfd[2].events = POLLOUT;
+  pfd[3].fd = -1;
+  if(poll(pfd, 4, 0) != 1 || pfd[0].revents != 0 || pfd[2].revents != POLLOUT){
+    printf("%s: poll of empty pipes wrong\n", s);
+    exit(1);
+  }
+  // times out.
+  if(poll(pfd, 2, 2) != 0){
+    printf("%s: poll did not time out\n", s);
+    exit(1);
+  }
+
+  // wakes up when the child writes to the second pipe.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf("%s: poll did not see the write\n", s);
+    exit(1);
+  }
+  wait(&xst);
+
+  // end of file, and bad descriptors.
+  close(b[1]);
+  close(a[0]);
+  pfd[0].fd = 99;
+  pfd[1].events = 0;
+  if(poll(pfd, 3, -1) != 3 || pfd[0].revents != POLLNVAL ||
+     pfd[1].revents != POLLHUP || (pfd[2].revents & POLLERR) == 0){
+    printf("%s: poll of closed pipes wrong\n", s);
+    exit(1);
+  }
+
+  fd = open("README", O_RDONLY);
+  pfd[0].fd = fd;
+  pfd[0].events = POLLIN|POLLOUT;
+  if(poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLIN){
+    printf("%s: poll of file wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(a[1]);
+  close(b[0]);
+}
+
+// Put a submission on ring u.
+void
+ringput(struct uring *u, int op, int fd, void *addr, int n, int off, uint64 data)
+{
+  struct sqe *e = &u->sq[u->sqtail % RINGSIZE];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->off = off;
+  e->data = data;
+  __sync_synchronize();
+  u->sqtail++;
+}
+
+// Results of the completions ringwaitall() saw, by data.
+static int ringres[16];
+
+// Submit everything on ring u and wait for all of it,
+// returning the result of the completion with data.
+int
+ringwaitall(char *s, struct uring *u, int n, uint64 data)
+{
+  int res = -2;
+  struct cqe *c;
+
+  if(ringenter(n, n) != n){
+    printf("%s: ringenter failed\n", s);
+    exit(1);
+  }
+  if(u->cqtail - u->cqhead != n){
+    printf("%s: %d completions, not %d\n", s, u->cqtail - u->cqhead, n);
+    exit(1);
+  }
+  while(u->cqhead != u->cqtail){
+    c = &u->cq[u->cqhead % RINGSIZE];
+    if(c->data == data)
+      res = c->res;
+    if(c->data < sizeof(ringres)/sizeof(ringres[0]))
+      ringres[c->data] = c->res;
+    u->cqhead++;
+  }
+  return res;
+}
+
+// system calls through the submission and completion rings.
+void
+ringtest(char *s)
+{
+  struct uring *u;
+  struct stat st;
+  char b[16];
+  int fd, pid, xst;
+
+  u = ringsetup();
+  if((uint64)u == -1 || ringsetup() != (struct uring*)-1){
+    printf("%s: ringsetup failed\n", s);
+    exit(1);
+  }
+  ringput(u, RING_OPEN, 0, "ringf", O_CREATE|O_RDWR, 0, 1);
+  if((fd = ringwaitall(s, u, 1, 1)) < 0){
+    printf("%s: ring open failed\n", s);
+    exit(1);
+  }
+  // a batch. The workers may run it in any order, so it has
+  // only one write: a write past the end of the file fails.
+  ringput(u, RING_WRITE, fd, "abcdefgh", 8, 0, 10);
+  ringput(u, RING_NOP, 0, 0, 0, 0, 2);
+  ringput(u, RING_READ, 99, b, 1, -1, 3);
+  if(ringwaitall(s, u, 3, 3) != -1){
+    printf("%s: read of bad fd succeeded\n", s);
+    exit(1);
+  }
+  if(ringres[10] != 8 || ringres[2] != 0){
+    printf("%s: ring write or nop failed\n", s);
+    exit(1);
+  }
+  ringput(u, RING_FSTAT, fd, &st, 0, 0, 4);
+  if(ringwaitall(s, u, 1, 4) != 0 || st.size != 8){
+    printf("%s: ring fstat wrong\n", s);
+    exit(1);
+  }
+  ringput(u, RING_READ, fd, b, sizeof(b), 2, 5);
+  if(ringwaitall(s, u, 1, 5) != 6 || memcmp(b, "cdefgh", 6) != 0){
+    printf("%s: ring read wrong\n", s);
+    exit(1);
+  }
+  ringput(u, RING_CLOSE, fd, 0, 0, 0, 6);
+  if(ringwaitall(s, u, 1, 6) != 0 || close(fd) >= 0){
+    printf("%s: ring close failed\n", s);
+    exit(1);
+  }
+
+  // a read that never completes doesn't hold up shrinking
+  // other memory, is cancelled by shrinking its own, and
+  // by exit().
+  pid = fork();
+  if(pid == 0){
+    int fds[2];
+    char *p;
+    u = ringsetup();
+    pipe(fds);
+    ringput(u, RING_READ, fds[0], b, 1, -1, 7);
+    ringenter(1, 0);
+    if(sbrk(PGSIZE) == (char*)-1 || sbrk(-PGSIZE) == (char*)-1)
+      exit(1);
+    p = sbrk(PGSIZE);
+    ringput(u, RING_READ, fds[0], p, 1, -1, 8);
+    ringenter(1, 0);
+    if(sbrk(-PGSIZE) == (char*)-1 || ringenter(0, 1) != 0 ||
+       u->cq[u->cqhead % RINGSIZE].data != 8 || u->cq[u->cqhead % RINGSIZE].res != -1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != 0){
+    printf("%s: ring child failed\n", s);
+    exit(1);
+  }
+  unlink("ringf");
+}
+
+// O_NONBLOCK reads and writes of a pipe.
+void
+nonblocktest(char *s)
+{
+  int fds[2], fd, n, sz;
+  char *b;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETFL, 0) != O_RDONLY ||
+     fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(fds[1], F_GETFL, 0) != (O_WRONLY|O_NONBLOCK)){
+    printf("%s: F_SETFL failed\n", s);
+    exit(1);
+  }
+  sz = fcntl(fds[0], F_GETPIPE_SZ, 0);
+  b = malloc(sz + 1);
+  if(read(fds[0], b, 1) != -EAGAIN){
+    printf("%s: read of empty pipe did not fail\n", s);
+    exit(1);
+  }
+  // a write that doesn't fit is cut short, then fails.
+  if((n = write(fds[1], b, sz + 1)) != sz || write(fds[1], b, 1) != -EAGAIN){
+    printf("%s: write of full pipe wrong (%d)\n", s, n);
+    exit(1);
+  }
+  if(read(fds[0], b, sz + 1) != sz || read(fds[0], b, 1) != -EAGAIN){
+    printf("%s: read of full pipe wrong\n", s);
+    exit(1);
+  }
+  // splice() to and from the pipe doesn't wait either.
+  unlink("nonblockf");
+  if((fd = open("nonblockf", O_CREATE|O_RDWR)) < 0 || write(fd, b, sz) != sz){
+    printf("%s: create nonblockf failed\n", s);
+    exit(1);
+  }
+  if(splice(fds[0], fd, 1) != -EAGAIN){
+    printf("%s: splice from empty pipe did not fail\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("nonblockf", O_RDONLY);
+  if(splice(fd, fds[1], sz) != sz || splice(fd, fds[1], 1) != -EAGAIN){
+    printf("%s: splice to full pipe wrong\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("nonblockf");
+  if(read(fds[0], b, sz + 1) != sz){
+    printf("%s: read of spliced data wrong\n", s);
+    exit(1);
+  }
+  close(fds[1]);
+  if(read(fds[0], b, 1) != 0){
+    printf("%s: no end of file\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  free(b);
+}
+
+// buffered printf output must reach the file once, even
+// across fork() and exit(), and gets() must read it back
+// line by line.
+void
+stdiotest(char *s)
+{
+  int fd, pid, xstatus;
+  char buf[16];
+
+  unlink("stdiotest");
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    if(open("stdiotest", O_CREATE|O_RDWR) != 1)
+      exit(1);
+    setvbuf(stdout, 0, _IOFBF, 0);
+    printf("a\n");
+    printf("b");
+    if((pid = fork()) == 0){
+      printf("c");
+      exit(0);
+    }
+    wait(0);
+    printf("d\n");
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: writer failed\n", s);
+    exit(1);
+  }
+  fd = open("stdiotest", O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 6 || memcmp(buf, "a\nbcd\n", 6) != 0){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    if(open("stdiotest", O_RDONLY) != 0)
+      exit(1);
+    if(strcmp(gets(buf, sizeof(buf)), "a\n") != 0 ||
+       strcmp(gets(buf, sizeof(buf)), "bcd\n") != 0 ||
+       strcmp(gets(buf, sizeof(buf)), "") != 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: gets failed\n", s);
+    exit(1);
+  }
+  unlink("stdiotest");
+}
+
+// blocks of every size class must not overlap, and freeing a
+// big block must give its memory back to the kernel.
+void
+malloctest(char *s)
+{
+  static char *p[200];
+  char *top0;
+  int i, j, n;
+
+  for(i = 0; i < 200; i++){
+    n = (i * 37) % 3000 + 1;
+    if((p[i] = malloc(n)) == 0 || ((uint64)p[i] % 16) != 0){
+      printf("%s: malloc(%d) failed\n", s, n);
+      exit(1);
+    }
+    memset(p[i], i, n);
+  }
+  for(i = 0; i < 200; i += 2)
+    free(p[i]);
+  for(i = 1; i < 200; i += 2){
+    n = (i * 37) % 3000 + 1;
+    for(j = 0; j < n; j++){
+      if(p[i][j] != (char)i){
+        printf("%s: block %d overwritten\n", s, i);
+        exit(1);
+      }
+    }
+    free(p[i]);
+  }
+
+  // blocks just bigger than the heap grows by, and than the
+  // free span the heap keeps when it is trimmed.
+  for(n = 40; n <= 80; n += 4){
+    if((p[0] = malloc(n*PGSIZE)) == 0){
+      printf("%s: malloc(%d pages) failed\n", s, n);
+      exit(1);
+    }
+    memset(p[0], 2, n*PGSIZE);
+    free(p[0]);
+  }
+
+  top0 = sbrk(0);
+  if((p[0] = malloc(1024*1024)) == 0){
+    printf("%s: malloc(1MB) failed\n", s);
+    exit(1);
+  }
+  memset(p[0], 1, 1024*1024);
+  free(p[0]);
+  if(sbrk(0) > top0 + 256*1024){
+    printf("%s: heap not trimmed\n", s);
+    exit(1);
+  }
+}
+
+// the word-at-a-time string functions must agree with simple
+// byte loops at every alignment and length, overlapping or not.
+void
+stringtest(char *s)
+{
+  static char a[256], b[256];
+  int so, dof, n, i;
+
+  for(so = 0; so < 9; so++){
+    for(dof = 0; dof < 9; dof++){
+      for(n = 0; n < 100; n++){
+        for(i = 0; i < sizeof(a); i++)
+          a[i] = b[i] = i * 7 + n;
+        memmove(a + 100 + dof, a + 100 + so, n);
+        if(so < dof){
+          for(i = n - 1; i >= 0; i--)
+            b[100 + dof + i] = b[100 + so + i];
+        } else {
+          for(i = 0; i < n; i++)
+            b[100 + dof + i] = b[100 + so + i];
+        }
+        if(memcmp(a, b, sizeof(a)) != 0){
+          printf("%s: memmove %d %d %d wrong\n", s, so, dof, n);
+          exit(1);
+        }
+        memset(a + dof, so, n);
+        for(i = 0; i < n; i++)
+          b[dof + i] = so;
+        for(i = 0; i < sizeof(a); i++){
+          if(a[i] != b[i]){
+            printf("%s: memset %d %d wrong\n", s, dof, n);
+            exit(1);
+          }
+        }
+        if(n > 0){
+          b[dof + n - 1]++;
+          if(memcmp(a + dof, b + dof, n) == 0 || memcmp(a + dof, b + dof, n - 1) != 0){
+            printf("%s: memcmp %d %d wrong\n", s, dof, n);
+            exit(1);
+          }
+        }
+        memset(a, 'x', sizeof(a));
+        a[so + n] = 0;
+        if(strlen(a + so) != n){
+          printf("%s: strlen %d %d wrong\n", s, so, n);
+          exit(1);
+        }
+      }
+    }
+  }
+}
+
+// the free-block counts of each order must add up to the free
+// page count, and growing the process must use up free pages.
+void
+kmemstattest(char *s)
+{
+  struct kmemstat st0, st1;
+  int k, n;
+
+  if(kmemstat(&st0) < 0){
+    printf("%s: kmemstat failed\n", s);
+    exit(1);
+  }
+  n = st0.nzeroed;
+  for(k = 0; k <= MAXORDER; k++)
+    n += st0.nblock[k] << k;
+  if(n != st0.nfree){
+    printf("%s: blocks hold %d pages, not %d\n", s, n, st0.nfree);
+    exit(1);
+  }
+  if(sbrk(64*PGSIZE) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  kmemstat(&st1);
+  if(st1.nfree > st0.nfree - 64){
+    printf("%s: sbrk didn't take pages (%d, %d)\n", s, st0.nfree, st1.nfree);
+    exit(1);
+  }
+}
+
+// hold more open files, pipes and inodes at once than the
+// kernel's tables used to have room for (100 files, 50 inodes).
+void
+manyobjs(char *s)
+{
+  enum{ NCHILD = 10, NF = 6, NP = 2 };
+  int ready[2], go[2], fds[NF], pfds[NP][2];
+  int i, j, pid, xstatus;
+  char name[8], c;
+
+  if(pipe(ready) < 0 || pipe(go) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(go[1]);
+      c = 'y';
+      name[0] = 'm';
+      name[1] = 'o';
+      name[2] = '0' + i;
+      name[4] = '\0';
+      for(j = 0; j < NF; j++){
+        name[3] = '0' + j;
+        if((fds[j] = open(name, O_CREATE|O_RDWR)) < 0 || write(fds[j], name, 4) != 4)
+          c = 'n';
+      }
+      for(j = 0; j < NP; j++)
+        if(pipe(pfds[j]) < 0 || write(pfds[j][1], &c, 1) != 1)
+          c = 'n';
+      write(ready[1], &c, 1);
+      // hold everything open until every child is ready.
+      read(go[0], &c, 1);
+      for(j = 0; j < NP; j++){
+        if(read(pfds[j][0], &c, 1) != 1)
+          exit(1);
+      }
+      for(j = 0; j < NF; j++){
+        name[3] = '0' + j;
+        close(fds[j]);
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  close(go[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1 || c != 'y'){
+      printf("%s: child couldn't open its files\n", s);
+      exit(1);
+    }
+  }
+  close(go[1]);
+  close(ready[0]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
+// a process can have many more than 16 descriptors, and
+// always gets the lowest free one.
+void
+manyfds(char *s)
+{
+  enum{ N = 300 };
+  static struct pollfd pfd[N];
+  int fds[2], i, fd, pid, xstatus;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = fds[1] + 1; i < N; i++){
+    if((fd = dup(fds[1])) != i){
+      printf("%s: dup returned %d, not %d\n", s, fd, i);
+      exit(1);
+    }
+  }
+  close(100);
+  close(7);
+  if(dup(fds[0]) != 7 || dup(fds[0]) != 100){
+    printf("%s: dup didn't reuse the lowest fd\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // the child's table is a copy of the parent's.
+    if(write(N-1, "x", 1) != 1)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child couldn't write fd %d\n", s, N-1);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    pfd[i].fd = i;
+    pfd[i].events = POLLIN;
+  }
+  if(poll(pfd, N, 0) < 1 || pfd[100].revents != POLLIN){
+    printf("%s: poll of %d fds failed\n", s, N);
+    exit(1);
+  }
+  for(i = 3; i < N; i++)
+    close(i);
+}
+
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void
 iref(char *s)
 {
+  enum{ NINODE = 50 };  // the size the inode table once had
   int i, fd;
 
   for(i = 0; i < NINODE + 1; i++){
@@ -2616,6 +3689,22 @@ struct test {
   {fourteen, "fourteen"},
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
+  {namecache, "namecache"},
+  {getdentstest, "getdents"},
+  {bcachetest, "bcache"},
+  {fsynctest, "fsync"},
+  {preadvtest, "preadv"},
+  {sendfiletest, "sendfile"},
+  {splicetest, "splice"},
+  {polltest, "poll"},
+  {ringtest, "ring"},
+  {nonblocktest, "nonblock"},
+  {stdiotest, "stdio"},
+  {malloctest, "malloc"},
+  {stringtest, "string"},
+  {kmemstattest, "kmemstat"},
+  {manyobjs, "manyobjs"},
+  {manyfds, "manyfds"},
   {iref, "iref"},
   {forktest, "forktest"},
   {sbrkbasic, "sbrkbasic"},
@@ -2684,6 +3773,92 @@ bigdir(char *s)
   }
 }
 
+// hashed directory that splits many buckets. checks that every
+// entry can be found, and that reading the directory linearly
+// sees each entry exactly once.
+void
+hashdir(char *s)
+{
+  enum { N = 400 };
+  int i, fd, n;
+  char name[DIRSIZ+1];
+  struct dirent de;
+
+  if(mkdir("hd") != 0 || (fd = open("hd/target", O_CREATE)) < 0){
+    printf("%s: hashdir create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[0] = 'h';
+    name[1] = 'd';
+    name[2] = '/';
+    name[3] = 'x';
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    name[7] = '\0';
+    if(link("hd/target", name) != 0){
+      printf("%s: hashdir link(%s) failed\n", s, name);
+      exit(1);
+    }
+  }
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: hashdir open(%s) failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  if((fd = open("hd", O_RDONLY)) < 0){
+    printf("%s: hashdir open(hd) failed\n", s);
+    exit(1);
+  }
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    if(de.inum == 0 || de.name[0] != 'x')
+      continue;
+    memmove(name, de.name, DIRSIZ);
+    name[DIRSIZ] = '\0';
+    i = atoi(name + 1);
+    if(i < 0 || i >= N){
+      printf("%s: hashdir bad entry %s\n", s, name);
+      exit(1);
+    }
+    n++;
+  }
+  close(fd);
+  if(n != N){
+    printf("%s: hashdir read %d entries, expected %d\n", s, n, N);
+    exit(1);
+  }
+
+  for(i = 0; i < N; i++){
+    name[0] = 'h';
+    name[1] = 'd';
+    name[2] = '/';
+    name[3] = 'x';
+    name[4] = '0' + (i / 100);
+    name[5] = '0' + (i / 10) % 10;
+    name[6] = '0' + (i % 10);
+    name[7] = '\0';
+    if(unlink(name) != 0){
+      printf("%s: hashdir unlink(%s) failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd/target") != 0 || unlink("hd") != 0){
+    printf("%s: hashdir cleanup failed\n", s);
+    exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -2926,6 +4101,7 @@ outofinodes(char *s)
 
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {hashdir, "hashdir"},
   {manywrites, "manywrites"},
   {badwrite, "badwrite" },
   {execout, "execout"},
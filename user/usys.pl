@@ -6,24 +6,26 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry(name [, label]): label defaults to name.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $label = shift || $name;
+    print ".global $label\n";
+    print "${label}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
 entry("close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -36,3 +38,19 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("getdents");
+entry("bcachestat");
+entry("fsync");
+entry("fdatasync");
+entry("pread");
+entry("pwrite");
+entry("readv");
+entry("writev");
+entry("sendfile");
+entry("splice");
+entry("vmsplice");
+entry("fcntl");
+entry("poll");
+entry("ringsetup");
+entry("ringenter");
+entry("kmemstat");
@@ -3,15 +3,15 @@
 #include "user/user.h"
 #include "kernel/param.h"
 
-#define STDIN 0
 #define STDERR 2
 
 int readStrLine(char *newArgv[MAXARG], int currentArgc) {
     char buf[1024];
-    int n = 0;
+    int n = 0, c;
 
     // Read one character at a time until newline or buffer capacity
-    while (read(STDIN, buf + n, sizeof(char))) {
+    while ((c = fgetc(stdin)) != EOF) {
+        buf[n] = c;
         if (n == 1023) {
             fprintf(STDERR, "argument is too long\n");
             exit(1);